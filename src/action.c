@@ -30,10 +30,6 @@ static String add_deps_filename = {OBJ_STRING, "add_deps.xsl"};
 static String rm_deps_filename = {OBJ_STRING, "rm_deps.xsl"};
 static String global_str = {OBJ_STRING, "global"};
 static String arg_str = {OBJ_STRING, "arg"};
-static Document *adddeps_document = NULL;
-static Document *rmdeps_document = NULL;
-static Document *fallback_processor = NULL;
-static Document *ddl_processor = NULL;
 
 static Cons *docstack = NULL;
 
@@ -95,42 +91,31 @@ docStackNth(int n)
     return nth;
 }
 
+/* The stylesheets returned by the following functions belong to the
+ * stylesheet cache and must not be freed.
+ */
 Document *
 getFallbackProcessor()
 {
-    if (!fallback_processor) {
-	fallback_processor = 
-	    findDoc((String*) symbolGetValue("fallback_processor"));
-    }
-    return fallback_processor;
+    return findStylesheet((String*) symbolGetValue("fallback_processor"));
 }
 
 Document *
 getDDLProcessor()
 {
-    if (!ddl_processor) {
-	ddl_processor = 
-	    findDoc((String*) symbolGetValue("ddl_processor"));
-    }
-    return ddl_processor;
+    return findStylesheet((String*) symbolGetValue("ddl_processor"));
 }
 
 static Document *
 getAddDepsDoc()
 {
-    if (!adddeps_document) {
-	adddeps_document = findDoc(&add_deps_filename);
-    }
-    return adddeps_document;
+    return findStylesheet(&add_deps_filename);
 }
 
 static Document *
 getRmDepsDoc()
 {
-    if (!rmdeps_document) {
-	rmdeps_document = findDoc(&rm_deps_filename);
-    }
-    return rmdeps_document;
+    return findStylesheet(&rm_deps_filename);
 }
 
 void
@@ -157,29 +142,6 @@ rmDeps()
     applyXSL(getRmDepsDoc());
 }
 
-void
-freeStdTemplates()
-{
-    if (adddeps_document) {
-	objectFree((Object *) adddeps_document, TRUE);
-	adddeps_document = NULL;
-    }
-
-    if (rmdeps_document) {
-	objectFree((Object *) rmdeps_document, TRUE);
-	rmdeps_document = NULL;
-    }
-
-    if (fallback_processor) {
-	objectFree((Object *) fallback_processor, TRUE);
-	fallback_processor = NULL;
-    }
-    if (ddl_processor) {
-	objectFree((Object *) ddl_processor, TRUE);
-	ddl_processor = NULL;
-    }
-}
-
 /* Load an input file into memory and place it on the stack for
  * subsequent processing.
  */
@@ -773,6 +735,8 @@ executePrint(Object *params)
     int docstack_entries = consLen(docstack);
     boolean print_full;
     boolean print_xml;
+    boolean print_gzip;
+    boolean print_binary;
     boolean has_deps;
     Document *doc;
     UNUSED(params);
@@ -788,6 +752,19 @@ executePrint(Object *params)
 
     print_full = dereference(symbolGetValue("full")) && TRUE;
     print_xml = dereference(symbolGetValue("xml")) && TRUE;
+    print_gzip = dereference(symbolGetValue("gzip")) && TRUE;
+    print_binary = dereference(symbolGetValue("binary")) && TRUE;
+
+    if (print_binary) {
+	if (print_gzip) {
+	    RAISE(PARAMETER_ERROR, 
+		  newstr("The --binary and --gzip options of action "
+			 "\"print\" cannot be combined"));
+	}
+	/* Binary dumps always include deps, so that they need not be
+	 * added again each time the dump is loaded. */
+	print_full = TRUE;
+    }
 
     doc = (Document *) docStackHead();
     has_deps = docHasDeps(doc);
@@ -804,11 +781,15 @@ executePrint(Object *params)
     }
     doc = (Document *) docStackPop();
 
-    if (docIsPrintable(doc) && (!print_xml) && (!print_full)) {
+    if (print_binary) {
+	binaryDumpWrite(stdout, doc);
+    }
+    else if (docIsPrintable(doc) && (!print_xml) && (!print_full) && 
+	     (!print_gzip)) {
 	documentPrint(stdout, doc);
     }
     else {
-	documentPrintXML(stdout, doc);
+	documentPrintXML(stdout, doc, print_gzip);
     }
     
     objectFree((Object *) doc, TRUE);
@@ -823,11 +804,13 @@ executeTemplate(Object *params)
     Int4 *sources = (Int4 *) dereference(symbolGetValue("sources"));
     int docstack_entries = consLen(docstack);
     String *action_name = (String *) dereference(symbolGetValue("action"));
-    Document *result;
+    Document *volatile result = NULL;
     boolean retain_deps;
+    boolean stream;
     xmlNode *root;
 
     retain_deps = dereference(symbolGetValue("retain_deps")) && TRUE;
+    stream = dereference(symbolGetValue("stream")) && TRUE;
 
     if (!sources) {
 	RAISE(GENERAL_ERROR, 
@@ -841,9 +824,30 @@ executeTemplate(Object *params)
 		     action_name? action_name->value: "template"));
     }
 
+    if (stream && args_remaining()) {
+	RAISE(PARAMETER_ERROR, 
+	      newstr("--stream may only be used for the last action"));
+    }
+
     preprocessSourceDocs(sources->value, params);
-    
-    if (result = processTemplate(template)) {
+
+    if (stream) {
+	/* The result is written to stdout as it is produced, so
+	 * nothing is left for the docstack. */
+	beginOutputStream(stdout);
+    }
+    BEGIN {
+	result = processTemplate(template);
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	if (stream) {
+	    endOutputStream();
+	}
+    }
+    END;
+
+    if (result) {
 	rmParamsNode(result);
 	if (retain_deps) {
 	    root = xmlDocGetRootElement(result->doc);
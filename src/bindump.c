@@ -0,0 +1,637 @@
+/**
+ * @file   bindump.c
+ * \code
+ *     Copyright (c) 2015 Marc Munro
+ *     Fileset:	skit - a database schema management toolset
+ *     Author:  Marc Munro
+ *     License: GPL V3
+ *
+ * \endcode
+ * @brief
+ * Provides functions for writing and reading binary dump files.
+ *
+ * A binary dump is a faithful copy of an xml document that can be
+ * loaded without any xml parsing.  The file is mapped into memory and
+ * each node record in it is turned directly into a libxml node.  It is
+ * written by print --binary, which also adds dependencies to the
+ * document, so that actions loading it need not run add_deps again.
+ *
+ * The file layout is:
+ *   magic    BINDUMP_MAGIC, whose last byte is the format version
+ *   header   optional refs to the document's xml version and encoding
+ *   records  the document's child nodes, terminated by BIN_END
+ *   strings  a count, followed by each string, nul-terminated
+ *   trailer  the offset of strings, as 8 little-endian bytes
+ *
+ * All other integers are unsigned LEB128 varints.  Strings are
+ * referred to by their index in the string table, which contains each
+ * distinct string once.  Optional refs are stored as index + 1, with 0
+ * meaning none.  Namespace refs are 0 for no namespace, 1 for the
+ * default namespace, or the index of the namespace prefix + 2.
+ *
+ * Each record starts with a BIN_xxx tag.  An element record contains:
+ * the name; a count of namespace definitions, each an optional prefix
+ * and an href; the element's namespace; a count of attributes, each a
+ * namespace, name and value; the element's child records; BIN_END.
+ * Text, cdata and comment records contain their content, and pi
+ * records a name and optional content.
+ *
+ * The string table is written last so that the dump can be written
+ * to a pipe in a single pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libxml/chvalid.h>
+#include "skit.h"
+#include "exceptions.h"
+
+#define BINDUMP_MAGIC     "skitbin1"
+#define BINDUMP_MAGIC_LEN 8
+#define BINDUMP_TRAILER_LEN 8
+
+#define BIN_END      0
+#define BIN_ELEMENT  1
+#define BIN_TEXT     2
+#define BIN_CDATA    3
+#define BIN_COMMENT  4
+#define BIN_PI       5
+
+typedef struct BinWriter {
+    FILE       *fp;
+    uint64_t    offset;		/* Number of bytes written so far */
+    GHashTable *index;		/* Maps each string to its index + 1 */
+    GPtrArray  *strings;	/* The string table, in index order */
+    GPtrArray  *owned;		/* Strings allocated by the writer */
+} BinWriter;
+
+typedef struct BinReader {
+    const unsigned char *pos;
+    const unsigned char *end;
+    const xmlChar      **strings; /* Pointers into the mapped file */
+    const xmlChar      **interned;/* Strings interned in doc's dict */
+    uint64_t             string_count;
+    xmlDoc              *doc;
+    char                *path;
+} BinReader;
+
+
+static void
+writeBytes(BinWriter *writer, const void *bytes, size_t len)
+{
+    if (fwrite(bytes, 1, len, writer->fp) != len) {
+	RAISE(GENERAL_ERROR, newstr("Failed to write binary dump"));
+    }
+    writer->offset += len;
+}
+
+static void
+writeVarint(BinWriter *writer, uint64_t value)
+{
+    unsigned char buf[10];
+    int len = 0;
+
+    do {
+	buf[len] = value & 0x7f;
+	value >>= 7;
+	if (value) {
+	    buf[len] |= 0x80;
+	}
+	len++;
+    } while (value);
+    writeBytes(writer, buf, len);
+}
+
+/* Return the index of str in the string table, adding it if this is
+ * its first appearance.  The table does not copy str, which must
+ * remain valid until the dump is complete.
+ */
+static uint64_t
+stringIndex(BinWriter *writer, const xmlChar *str)
+{
+    guint idx = GPOINTER_TO_UINT(g_hash_table_lookup(writer->index, str));
+
+    if (!idx) {
+	g_ptr_array_add(writer->strings, (gpointer) str);
+	idx = writer->strings->len;
+	g_hash_table_insert(writer->index, (gpointer) str,
+			    GUINT_TO_POINTER(idx));
+    }
+    return idx - 1;
+}
+
+static void
+writeString(BinWriter *writer, const xmlChar *str)
+{
+    writeVarint(writer, stringIndex(writer, str? str: (xmlChar *) ""));
+}
+
+static void
+writeOptString(BinWriter *writer, const xmlChar *str)
+{
+    writeVarint(writer, str? stringIndex(writer, str) + 1: 0);
+}
+
+static void
+writeNsRef(BinWriter *writer, xmlNs *ns)
+{
+    if (!ns) {
+	writeVarint(writer, 0);
+    }
+    else if (!ns->prefix) {
+	writeVarint(writer, 1);
+    }
+    else {
+	writeVarint(writer, stringIndex(writer, ns->prefix) + 2);
+    }
+}
+
+/* Return the value of attr.  Values consisting of a single text node,
+ * which is almost all of them, are returned without copying.
+ */
+static const xmlChar *
+attrValue(BinWriter *writer, xmlAttr *attr)
+{
+    xmlChar *value;
+
+    if (!attr->children) {
+	return (xmlChar *) "";
+    }
+    if ((attr->children->type == XML_TEXT_NODE) && !attr->children->next) {
+	return attr->children->content;
+    }
+    value = xmlNodeListGetString(attr->doc, attr->children, 1);
+    g_ptr_array_add(writer->owned, value);
+    return value;
+}
+
+static void writeNodeList(BinWriter *writer, xmlNode *node);
+
+static void
+writeElement(BinWriter *writer, xmlNode *node)
+{
+    xmlNs *ns;
+    xmlAttr *attr;
+    int count;
+
+    writeVarint(writer, BIN_ELEMENT);
+    writeString(writer, node->name);
+
+    for (count = 0, ns = node->nsDef; ns; ns = ns->next) {
+	count++;
+    }
+    writeVarint(writer, count);
+    for (ns = node->nsDef; ns; ns = ns->next) {
+	writeOptString(writer, ns->prefix);
+	writeString(writer, ns->href);
+    }
+    writeNsRef(writer, node->ns);
+
+    for (count = 0, attr = node->properties; attr; attr = attr->next) {
+	count++;
+    }
+    writeVarint(writer, count);
+    for (attr = node->properties; attr; attr = attr->next) {
+	writeNsRef(writer, attr->ns);
+	writeString(writer, attr->name);
+	writeString(writer, attrValue(writer, attr));
+    }
+
+    writeNodeList(writer, node->children);
+}
+
+/* Write records for node and its siblings, followed by BIN_END. */
+static void
+writeNodeList(BinWriter *writer, xmlNode *node)
+{
+    for (; node; node = node->next) {
+	switch (node->type) {
+	case XML_ELEMENT_NODE:
+	    writeElement(writer, node);
+	    break;
+	case XML_TEXT_NODE:
+	    writeVarint(writer, BIN_TEXT);
+	    writeString(writer, node->content);
+	    break;
+	case XML_CDATA_SECTION_NODE:
+	    writeVarint(writer, BIN_CDATA);
+	    writeString(writer, node->content);
+	    break;
+	case XML_COMMENT_NODE:
+	    writeVarint(writer, BIN_COMMENT);
+	    writeString(writer, node->content);
+	    break;
+	case XML_PI_NODE:
+	    writeVarint(writer, BIN_PI);
+	    writeString(writer, node->name);
+	    writeOptString(writer, node->content);
+	    break;
+	case XML_XINCLUDE_START:
+	case XML_XINCLUDE_END:
+	case XML_DTD_NODE:
+	    /* These are not carried over into binary dumps. */
+	    break;
+	default:
+	    RAISE(XML_PROCESSING_ERROR,
+		  newstr("Cannot write node of type %d to binary dump",
+			 node->type));
+	}
+    }
+    writeVarint(writer, BIN_END);
+}
+
+/* Write doc to fp as a binary dump. */
+void
+binaryDumpWrite(FILE *fp, Document *doc)
+{
+    BinWriter writer;
+    unsigned char trailer[BINDUMP_TRAILER_LEN];
+    uint64_t table_offset;
+    const xmlChar *str;
+    guint i;
+
+    writer.fp = fp;
+    writer.offset = 0;
+    writer.index = g_hash_table_new(g_str_hash, g_str_equal);
+    writer.strings = g_ptr_array_new();
+    writer.owned = g_ptr_array_new_with_free_func(xmlFree);
+
+    BEGIN {
+	writeBytes(&writer, BINDUMP_MAGIC, BINDUMP_MAGIC_LEN);
+	writeOptString(&writer, doc->doc->version);
+	writeOptString(&writer, doc->doc->encoding);
+	writeNodeList(&writer, doc->doc->children);
+
+	table_offset = writer.offset;
+	writeVarint(&writer, writer.strings->len);
+	for (i = 0; i < writer.strings->len; i++) {
+	    str = g_ptr_array_index(writer.strings, i);
+	    writeBytes(&writer, str, strlen((char *) str) + 1);
+	}
+	for (i = 0; i < BINDUMP_TRAILER_LEN; i++) {
+	    trailer[i] = (table_offset >> (8 * i)) & 0xff;
+	}
+	writeBytes(&writer, trailer, BINDUMP_TRAILER_LEN);
+	fflush(fp);
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	g_hash_table_destroy(writer.index);
+	g_ptr_array_free(writer.strings, TRUE);
+	g_ptr_array_free(writer.owned, TRUE);
+    }
+    END;
+}
+
+/* Return TRUE if the file at path starts with the binary dump magic
+ * number.  The version byte is checked only when the dump is read, so
+ * that a dump from another version gets a useful error.
+ */
+boolean
+isBinaryDump(String *path)
+{
+    char magic[BINDUMP_MAGIC_LEN];
+    boolean result = FALSE;
+    FILE *fp;
+
+    if (fp = fopen(path->value, "r")) {
+	result = (fread(magic, 1, BINDUMP_MAGIC_LEN, fp) ==
+		  BINDUMP_MAGIC_LEN) &&
+	    (memcmp(magic, BINDUMP_MAGIC, BINDUMP_MAGIC_LEN - 1) == 0);
+	fclose(fp);
+    }
+    return result;
+}
+
+static void
+corruptDump(BinReader *reader)
+{
+    RAISE(PARAMETER_ERROR,
+	  newstr("Binary dump %s is corrupt", reader->path));
+}
+
+static uint64_t
+readVarint(BinReader *reader)
+{
+    uint64_t result = 0;
+    int shift = 0;
+    unsigned char byte;
+
+    do {
+	if ((reader->pos >= reader->end) || (shift > 63)) {
+	    corruptDump(reader);
+	}
+	byte = *reader->pos++;
+	result |= ((uint64_t) (byte & 0x7f)) << shift;
+	shift += 7;
+    } while (byte & 0x80);
+    return result;
+}
+
+static uint64_t
+checkIndex(BinReader *reader, uint64_t idx)
+{
+    if (idx >= reader->string_count) {
+	corruptDump(reader);
+    }
+    return idx;
+}
+
+static const xmlChar *
+readString(BinReader *reader)
+{
+    return reader->strings[checkIndex(reader, readVarint(reader))];
+}
+
+static const xmlChar *
+readOptString(BinReader *reader)
+{
+    uint64_t ref = readVarint(reader);
+
+    if (ref == 0) {
+	return NULL;
+    }
+    return reader->strings[checkIndex(reader, ref - 1)];
+}
+
+/* Return string idx as interned in the document's dictionary.  Each
+ * string is looked up in the dictionary at most once.
+ */
+static const xmlChar *
+internedString(BinReader *reader, uint64_t idx)
+{
+    if (!reader->interned[idx]) {
+	if (!(reader->interned[idx] =
+	      xmlDictLookup(reader->doc->dict, reader->strings[idx], -1))) {
+	    RAISE(MEMORY_ERROR, newstr("Failed to intern string"));
+	}
+    }
+    return reader->interned[idx];
+}
+
+static const xmlChar *
+readInterned(BinReader *reader)
+{
+    return internedString(reader, checkIndex(reader, readVarint(reader)));
+}
+
+static xmlNs *
+readNsRef(BinReader *reader, xmlNode *node)
+{
+    uint64_t code = readVarint(reader);
+    const xmlChar *prefix = NULL;
+    xmlNs *ns;
+
+    if (code == 0) {
+	return NULL;
+    }
+    if (code > 1) {
+	prefix = reader->strings[checkIndex(reader, code - 2)];
+    }
+    if (!(ns = xmlSearchNs(reader->doc, node, prefix))) {
+	corruptDump(reader);
+    }
+    return ns;
+}
+
+static boolean
+isBlank(const xmlChar *str)
+{
+    while (*str) {
+	if (!xmlIsBlank_ch(*str)) {
+	    return FALSE;
+	}
+	str++;
+    }
+    return TRUE;
+}
+
+/* Text nodes consisting only of whitespace are interned, as they would
+ * be by the parser, since there are many identical ones.
+ */
+static xmlNode *
+readText(BinReader *reader)
+{
+    uint64_t idx = checkIndex(reader, readVarint(reader));
+    xmlNode *node;
+
+    if (!isBlank(reader->strings[idx])) {
+	return xmlNewDocText(reader->doc, reader->strings[idx]);
+    }
+    if (node = xmlNewDocText(reader->doc, NULL)) {
+	node->content = (xmlChar *) internedString(reader, idx);
+    }
+    return node;
+}
+
+static void
+linkChild(xmlNode *parent, xmlNode *node)
+{
+    if (!node) {
+	RAISE(MEMORY_ERROR, newstr("Failed to create node"));
+    }
+    node->parent = parent;
+    if (parent->last) {
+	parent->last->next = node;
+	node->prev = parent->last;
+    }
+    else {
+	parent->children = node;
+    }
+    parent->last = node;
+}
+
+static void readNodeList(BinReader *reader, xmlNode *parent);
+
+static void
+readElement(BinReader *reader, xmlNode *parent)
+{
+    xmlNode *node;
+    const xmlChar *prefix;
+    const xmlChar *href;
+    xmlNs *ns;
+    const xmlChar *name;
+    const xmlChar *value;
+    uint64_t count;
+
+    node = xmlNewDocNodeEatName(reader->doc, NULL,
+				(xmlChar *) readInterned(reader), NULL);
+    linkChild(parent, node);
+
+    for (count = readVarint(reader); count; count--) {
+	prefix = readOptString(reader);
+	href = readString(reader);
+	(void) xmlNewNs(node, href, prefix);
+    }
+    xmlSetNs(node, readNsRef(reader, node));
+
+    for (count = readVarint(reader); count; count--) {
+	ns = readNsRef(reader, node);
+	name = readInterned(reader);
+	value = readString(reader);
+	if (!xmlNewNsPropEatName(node, ns, (xmlChar *) name, value)) {
+	    RAISE(MEMORY_ERROR, newstr("Failed to create attribute"));
+	}
+    }
+
+    readNodeList(reader, node);
+}
+
+/* Read records up to the next BIN_END, adding them as children of
+ * parent.
+ */
+static void
+readNodeList(BinReader *reader, xmlNode *parent)
+{
+    uint64_t tag;
+    const xmlChar *name;
+
+    while ((tag = readVarint(reader)) != BIN_END) {
+	switch (tag) {
+	case BIN_ELEMENT:
+	    readElement(reader, parent);
+	    break;
+	case BIN_TEXT:
+	    linkChild(parent, readText(reader));
+	    break;
+	case BIN_CDATA:
+	    name = readString(reader);
+	    linkChild(parent, xmlNewCDataBlock(reader->doc, name,
+					       xmlStrlen(name)));
+	    break;
+	case BIN_COMMENT:
+	    linkChild(parent, xmlNewDocComment(reader->doc,
+					       readString(reader)));
+	    break;
+	case BIN_PI:
+	    name = readString(reader);
+	    linkChild(parent, xmlNewDocPI(reader->doc, name,
+					  readOptString(reader)));
+	    break;
+	default:
+	    corruptDump(reader);
+	}
+    }
+}
+
+/* Fill in the string table from the mapped file, checking that every
+ * string is terminated within the table.
+ */
+static void
+readStringTable(BinReader *reader)
+{
+    const unsigned char *nul;
+    uint64_t i;
+
+    for (i = 0; i < reader->string_count; i++) {
+	if (!(nul = memchr(reader->pos, '\0', reader->end - reader->pos))) {
+	    corruptDump(reader);
+	}
+	reader->strings[i] = reader->pos;
+	reader->pos = nul + 1;
+    }
+}
+
+/* Load a binary dump, as written by binaryDumpWrite, from path. */
+Document *
+binaryDumpRead(String *path)
+{
+    BinReader reader = {NULL, NULL, NULL, NULL, 0, NULL, path->value};
+    const xmlChar **volatile strings = NULL;
+    const xmlChar **volatile interned = NULL;
+    xmlDoc *volatile doc = NULL;
+    Document *volatile result = NULL;
+    const unsigned char *base;
+    const xmlChar *version;
+    const xmlChar *encoding;
+    uint64_t table_offset = 0;
+    struct stat st;
+    size_t size;
+    void *map;
+    int fd;
+    int i;
+
+    if ((fd = open(path->value, O_RDONLY)) < 0) {
+	RAISE(PARAMETER_ERROR, newstr("Cannot open file %s", path->value));
+    }
+    if ((fstat(fd, &st) < 0) ||
+	(st.st_size < BINDUMP_MAGIC_LEN + BINDUMP_TRAILER_LEN)) {
+	close(fd);
+	corruptDump(&reader);
+    }
+    size = st.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	RAISE(GENERAL_ERROR, newstr("Cannot map file %s", path->value));
+    }
+    base = (const unsigned char *) map;
+
+    BEGIN {
+	if (memcmp(base, BINDUMP_MAGIC, BINDUMP_MAGIC_LEN) != 0) {
+	    RAISE(PARAMETER_ERROR,
+		  newstr("Binary dump %s has an unsupported format version",
+			 path->value));
+	}
+	for (i = BINDUMP_TRAILER_LEN - 1; i >= 0; i--) {
+	    table_offset = (table_offset << 8) |
+		base[size - BINDUMP_TRAILER_LEN + i];
+	}
+	if ((table_offset < BINDUMP_MAGIC_LEN) ||
+	    (table_offset > size - BINDUMP_TRAILER_LEN)) {
+	    corruptDump(&reader);
+	}
+
+	reader.pos = base + table_offset;
+	reader.end = base + size - BINDUMP_TRAILER_LEN;
+	reader.string_count = readVarint(&reader);
+	if (reader.string_count > (uint64_t) (reader.end - reader.pos)) {
+	    /* Each string occupies at least one byte. */
+	    corruptDump(&reader);
+	}
+	reader.strings = strings = 
+	    skalloc((reader.string_count + 1) * sizeof(xmlChar *));
+	reader.interned = interned = 
+	    skalloc((reader.string_count + 1) * sizeof(xmlChar *));
+	memset(interned, 0, (reader.string_count + 1) * sizeof(xmlChar *));
+	readStringTable(&reader);
+
+	reader.pos = base + BINDUMP_MAGIC_LEN;
+	reader.end = base + table_offset;
+	version = readOptString(&reader);
+	encoding = readOptString(&reader);
+
+	doc = xmlNewDoc(version? version: (xmlChar *) "1.0");
+	if (encoding) {
+	    doc->encoding = xmlStrdup(encoding);
+	}
+	doc->dict = xmlDictCreate();
+	reader.doc = doc;
+
+	readNodeList(&reader, (xmlNode *) doc);
+	if (reader.pos != reader.end) {
+	    corruptDump(&reader);
+	}
+	result = documentNew(doc, NULL);
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	if (!result && doc) {
+	    xmlFreeDoc(doc);
+	}
+	if (strings) {
+	    skfree((void *) strings);
+	}
+	if (interned) {
+	    skfree((void *) interned);
+	}
+	munmap(map, size);
+    }
+    END;
+
+    return result;
+}
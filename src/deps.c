@@ -310,7 +310,6 @@ makeQnHashes(volatile ResolverState *res_state)
 {
     int i;
     DagNode *node;
-    String *pqn;
 
     Hash *by_fqn = hashNew(TRUE);
     Hash *by_pqn = hashNew(TRUE);
@@ -326,9 +325,8 @@ makeQnHashes(volatile ResolverState *res_state)
 		  newstr("Duplicate fqn found: %s", node->fqn->value));
 	}
 
-	if (pqn = nodeAttribute(node->dbobject, "pqn")) {
-	    (void) addToHash(by_pqn, pqn, node);
-	    objectFree((Object *) pqn, TRUE);
+	if (node->pqn) {
+	    (void) addToHash(by_pqn, node->pqn, node);
 	}
     }
 
@@ -358,7 +356,6 @@ makeMirrorNode(DagNode *node, volatile ResolverState *res_state)
 {
     DagNode *mirror;
     DagNodeBuildType type;
-    String *pqn;
 
     assertDagNode(node);
     type = mirroredBuildType(node->build_type);
@@ -369,9 +366,8 @@ makeMirrorNode(DagNode *node, volatile ResolverState *res_state)
 	vectorPush(res_state->all_nodes, (Object *) mirror);
 	addToHash(res_state->by_fqn, node->fqn, mirror);
 	
-	if (pqn = nodeAttribute(node->dbobject, "pqn")) {
-	    addToHash(res_state->by_pqn, pqn, mirror);
-	    objectFree((Object *) pqn, TRUE);
+	if (node->pqn) {
+	    addToHash(res_state->by_pqn, node->pqn, mirror);
 	}
     }
 }
@@ -1713,13 +1709,10 @@ ensureUniqueBreaker(DagNode *breaker, volatile ResolverState *res_state)
 static DagNode *
 getBreakerFor(DagNode *node, volatile ResolverState *res_state)
 {
-    String *breaker_type = nodeAttribute(node->dbobject, "cycle_breaker");
     DagNode *breaker = NULL;
  
-    if (breaker_type) {
-	breaker = makeBreakerNode(node, breaker_type);
-	objectFree((Object *) breaker_type, TRUE);
-	
+    if (node->cycle_breaker) {
+	breaker = makeBreakerNode(node, node->cycle_breaker);
 	breaker = ensureUniqueBreaker(breaker, res_state);
     }
     return breaker;
@@ -2018,6 +2011,185 @@ resolveNode(
 	return FALSE;
     }
 }
+
+/* State for the strongly connected component search in sccOrder().
+ * Nodes are numbered in the order that they are first visited, with
+ * the number (plus 1) recorded in node->scc_index.  As a node may have
+ * been numbered by an earlier search, the number is only trusted if
+ * it leads back to the node in this search's order array.
+ */
+typedef struct SccState {
+    int       count;
+    int       visited;
+    DagNode **order;
+    int      *lowlink;
+    boolean  *on_stack;
+    DagNode **stack;
+    int       stack_depth;
+    DagNode **frame_nodes;
+    int      *frame_next;
+    int       frame_depth;
+    Vector   *result;
+} SccState;
+
+static int
+sccIndex(SccState *state, DagNode *node)
+{
+    int idx = node->scc_index - 1;
+    if ((idx >= 0) && (idx < state->visited) && (state->order[idx] == node)) {
+	return idx;
+    }
+    return -1;
+}
+
+static void
+sccVisit(SccState *state, DagNode *node)
+{
+    int idx = state->visited++;
+    state->order[idx] = node;
+    state->lowlink[idx] = idx;
+    state->on_stack[idx] = TRUE;
+    node->scc_index = idx + 1;
+    state->stack[state->stack_depth++] = node;
+    state->frame_nodes[state->frame_depth] = node;
+    state->frame_next[state->frame_depth++] = 0;
+}
+
+/* Called once all of node's dependencies have been explored.  If node
+ * is the root of a component, the whole component is popped from the
+ * stack and added to the result, in the order in which its nodes were
+ * visited.
+ */
+static void
+sccFinish(SccState *state, DagNode *node)
+{
+    int idx = sccIndex(state, node);
+    int first;
+    int i;
+
+    if (state->lowlink[idx] == idx) {
+	first = state->stack_depth;
+	do {
+	    first--;
+	    state->on_stack[sccIndex(state, state->stack[first])] = FALSE;
+	} while (state->stack[first] != node);
+	for (i = first; i < state->stack_depth; i++) {
+	    vectorPush(state->result, (Object *) state->stack[i]);
+	}
+	state->stack_depth = first;
+    }
+}
+
+/* Return the nodes of the dependency graph grouped into their strongly
+ * connected components, using Tarjan's algorithm.  All dependencies
+ * are considered whether or not they are the chosen option of their
+ * dependency set, so any cycle that the resolver may encounter, for
+ * any choice of options, lies within a single component.  Components
+ * are returned in reverse topological order (each after all of the
+ * components that it depends on), and the first node of each is the
+ * one through which the depth first search entered it.
+ */
+static Vector *
+sccOrder(Vector *nodes)
+{
+    SccState state;
+    DagNode *node;
+    DagNode *next;
+    Dependency *dep;
+    int i;
+    int idx;
+    int next_idx;
+
+    state.count = nodes->elems;
+    state.visited = 0;
+    state.order = (DagNode **) skalloc(state.count * sizeof(DagNode *));
+    state.lowlink = (int *) skalloc(state.count * sizeof(int));
+    state.on_stack = (boolean *) skalloc(state.count * sizeof(boolean));
+    state.stack = (DagNode **) skalloc(state.count * sizeof(DagNode *));
+    state.stack_depth = 0;
+    state.frame_nodes = (DagNode **) skalloc(state.count * sizeof(DagNode *));
+    state.frame_next = (int *) skalloc(state.count * sizeof(int));
+    state.frame_depth = 0;
+    state.result = vectorNew(state.count);
+
+    EACH(nodes, i) {
+	node = (DagNode *) ELEM(nodes, i);
+	if (sccIndex(&state, node) >= 0) {
+	    continue;
+	}
+	if (state.visited >= state.count) {
+	    /* Nodes from outside of the vector have been visited, so
+	     * there is no room for more.  Any remaining nodes will be
+	     * picked up by the caller. */
+	    break;
+	}
+	sccVisit(&state, node);
+	while (state.frame_depth) {
+	    node = state.frame_nodes[state.frame_depth - 1];
+	    idx = sccIndex(&state, node);
+	    if (node->deps && 
+		(state.frame_next[state.frame_depth - 1] < node->deps->elems)) {
+		dep = (Dependency *) ELEM(node->deps, 
+					  state.frame_next[
+					      state.frame_depth - 1]++);
+		if (!(dep && (next = dep->dep))) {
+		    continue;
+		}
+		if ((next_idx = sccIndex(&state, next)) < 0) {
+		    if (state.visited < state.count) {
+			sccVisit(&state, next);
+		    }
+		    /* Otherwise there is no room to record next, which
+		     * can only happen if it is not in nodes. */
+		}
+		else if (state.on_stack[next_idx] &&
+			 (next_idx < state.lowlink[idx])) {
+		    state.lowlink[idx] = next_idx;
+		}
+	    }
+	    else {
+		state.frame_depth--;
+		sccFinish(&state, node);
+		if (state.frame_depth) {
+		    next_idx = sccIndex(
+			&state, state.frame_nodes[state.frame_depth - 1]);
+		    if (state.lowlink[idx] < state.lowlink[next_idx]) {
+			state.lowlink[next_idx] = state.lowlink[idx];
+		    }
+		}
+	    }
+	}
+    }
+
+    skfree(state.order);
+    skfree(state.lowlink);
+    skfree(state.on_stack);
+    skfree(state.stack);
+    skfree(state.frame_nodes);
+    skfree(state.frame_next);
+    return state.result;
+}
+
+static void
+resolveFromNode(DagNode *node, volatile ResolverState *res_state)
+{
+    char *errmsg;
+    char *tmp;
+    Dependency *dep;
+    DEPTHVAR;
+
+    PPREFIX("\nresolveDependencySets():") PSEXP(node);
+    if (node->build_type != DEACTIVATED_NODE) {
+	if (resolveNode(node, res_state, 1, FALSE)) {
+	    dep = curDep(node);
+	    tmp = cycleDescription(dep);
+	    errmsg = newstr("Unresolved dependency cycle: %s", tmp);
+	    skfree(tmp);
+	    RAISE(TSORT_CYCLIC_DEPENDENCY, errmsg);
+	}
+    }
+}
+
 /* This traverses the current dependency graph using a tsort like
  * mechanism to identify cycles.  When a cycle is found we try each
  * optional dependency in turn to try to eliminate all cycles.  If we
@@ -2027,30 +2199,39 @@ resolveNode(
  * the graph and one for the drop side.  The drop side can then be
  * inverted and the DAGS combined to create a single final DAG which
  * tsort can then traverse without concern.
+ *
+ * To keep the search for, and resolution of, cycles local, nodes are
+ * resolved one strongly connected component at a time, starting with
+ * components that depend on nothing unresolved.  Each search then
+ * stays within its own component, as everything else that it can
+ * reach has already been visited.  Within a component, cycles are
+ * still resolved by trying the options of its dependency sets in turn
+ * (see depsetNextDep()) and unwinding to retry, so that search remains
+ * exponential in the number of dependency sets involved in the
+ * component's cycles, but no longer in those of the rest of the graph.
+ * A final pass picks up any nodes, such as cycle breakers and
+ * fallbacks, created along the way.
  */
 static void
 resolveDependencySets(volatile ResolverState *res_state)
 {
+    Vector *volatile by_component = sccOrder(res_state->all_nodes);
     int i;
-    DagNode *node;
-    char *errmsg;
-    char *tmp;
-    Dependency *dep;
-    DEPTHVAR;
 
-    EACH(res_state->all_nodes, i) {
-	node = (DagNode *) ELEM(res_state->all_nodes, i);
-	PPREFIX("\nresolveDependencySets():") PSEXP(node);
-	if (node->build_type != DEACTIVATED_NODE) {
-	    if (resolveNode(node, res_state, 1, FALSE)) {
-		dep = curDep(node);
-		tmp = cycleDescription(dep);
-		errmsg = newstr("Unresolved dependency cycle: %s", tmp);
-		skfree(tmp);
-		RAISE(TSORT_CYCLIC_DEPENDENCY, errmsg);
-	    }
+    BEGIN {
+	EACH(by_component, i) {
+	    resolveFromNode((DagNode *) ELEM(by_component, i), res_state);
+	}
+	EACH(res_state->all_nodes, i) {
+	    resolveFromNode((DagNode *) ELEM(res_state->all_nodes, i), 
+			    res_state);
 	}
     }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree((Object *) by_component, FALSE);
+    }
+    END;
 }
 
 static void
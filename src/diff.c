@@ -18,13 +18,17 @@
 #include "exceptions.h"
 
 
+static void fingerprintDbobjects(Document *doc);
+
 static void
 readDocs(Document **p_doc1, Document **p_doc2)
 {
     addDeps();     /* Ensure next doc on stack has deps */
     *p_doc1 = docStackPop();
+    fingerprintDbobjects(*p_doc1);
     addDeps();     /* Ensure next doc on stack has deps */
     *p_doc2 = docStackPop();
+    fingerprintDbobjects(*p_doc2);
 }
 
 static void
@@ -995,6 +999,11 @@ dbobjectDiff(xmlNode *dbobject1, xmlNode *node2,
 static void processDiffs(xmlNode *node1,  xmlNode *node2, Hash *rules, 
 			 xmlNode *result_parent, boolean *diffs);
 
+static xmlNode *diffPair(xmlNode *dbobject1, xmlNode *dbobject2, 
+			 Hash *rules, boolean *diffs);
+
+static xmlNode *contentsNodeForDbobject(xmlNode *dbobject);
+
 
 static xmlNode *
 rulesetForNode(xmlNode *node, Hash *rules)
@@ -1080,6 +1089,156 @@ addDepsForDiff(xmlNode *to_node, xmlNode *dbobject, boolean is_forwards)
     xmlAddChild(to_node, deps);
 }
 
+static void
+checksumStr(GChecksum *checksum, char *str)
+{
+    g_checksum_update(checksum, (guchar *) str, strlen(str) + 1);
+}
+
+static void
+checksumNode(GChecksum *checksum, xmlNode *node)
+{
+    xmlBuffer *buf = xmlBufferCreate();
+    int len = xmlNodeDump(buf, node->doc, node, 0, 0);
+
+    if (len > 0) {
+	g_checksum_update(checksum, xmlBufferContent(buf), len);
+    }
+    xmlBufferFree(buf);
+}
+
+static void
+checksumAttributes(GChecksum *checksum, xmlNode *node)
+{
+    xmlAttr *attr;
+    xmlChar *value;
+
+    checksumStr(checksum, (char *) node->name);
+    for (attr = node->properties; attr; attr = attr->next) {
+	value = xmlNodeListGetString(node->doc, attr->children, 1);
+	checksumStr(checksum, (char *) attr->name);
+	checksumStr(checksum, value? (char *) value: "");
+	xmlFree(value);
+    }
+}
+
+/* Record a fingerprint in the fingerprint attribute of dbobject, and of
+ * each dbobject within it.  The fingerprint is a checksum of the
+ * dbobject's own attributes and of its contents node: its name, its
+ * attributes, its children other than dbobjects and whitespace and, in
+ * order, the fingerprints of its dbobject children.  Dbobjects with the
+ * same fingerprint therefore have identical contents all the way down,
+ * and their dbobject children pair up in order.  Any fingerprint
+ * already in the document, eg from an input file that has been through
+ * add_deps, is replaced rather than trusted.  A dbobject with no
+ * contents node is given no fingerprint.
+ */
+static void
+fingerprintDbobject(xmlNode *dbobject)
+{
+    xmlNode *contents;
+    xmlNode *child;
+    xmlChar *kid;
+    GChecksum *checksum;
+
+    (void) xmlUnsetProp(dbobject, (xmlChar *) "fingerprint");
+    if (!(contents = skipToContents(dbobject))) {
+	return;
+    }
+
+    checksum = g_checksum_new(G_CHECKSUM_MD5);
+    checksumAttributes(checksum, dbobject);
+    checksumAttributes(checksum, contents);
+    for (child = contents->children; child; child = child->next) {
+	if ((child->type == XML_ELEMENT_NODE) && 
+	    streq((char *) child->name, "dbobject")) {
+	    fingerprintDbobject(child);
+	    kid = xmlGetProp(child, (xmlChar *) "fingerprint");
+	    checksumStr(checksum, "dbobject");
+	    checksumStr(checksum, kid? (char *) kid: "");
+	    xmlFree(kid);
+	}
+	else if (!xmlIsBlankNode(child)) {
+	    checksumNode(checksum, child);
+	}
+    }
+
+    (void) xmlSetProp(dbobject, (xmlChar *) "fingerprint", 
+		      (xmlChar *) g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+}
+
+/* Fingerprint every dbobject in doc.  This is done once for each
+ * document, as soon as its dependencies have been added. */
+static void
+fingerprintDbobjects(Document *doc)
+{
+    xmlNode *root = xmlDocGetRootElement(doc->doc);
+    xmlNode *dbobject = root? getDbobject(root->children): NULL;
+
+    while (dbobject) {
+	fingerprintDbobject(dbobject);
+	dbobject = getDbobject(dbobject->next);
+    }
+}
+
+/* Identify whether dbobject1 and dbobject2 have identical contents,
+ * in which case there is no need to check their differences, or to
+ * match their dbobject children by key. */
+static boolean
+sameFingerprint(xmlNode *dbobject1, xmlNode *dbobject2)
+{
+    String *fingerprint1 = nodeAttribute(dbobject1, "fingerprint");
+    String *fingerprint2 = nodeAttribute(dbobject2, "fingerprint");
+    boolean result = fingerprint1 && fingerprint2 &&
+	streq(fingerprint1->value, fingerprint2->value);
+
+    objectFree((Object *) fingerprint1, TRUE);
+    objectFree((Object *) fingerprint2, TRUE);
+    return result;
+}
+
+/* Copy a dbobject node, without its contents, for the diff result.
+ * Fingerprints describe the source documents and so are not copied. */
+static xmlNode *
+copyDbobject(xmlNode *dbobject)
+{
+    xmlNode *result = xmlCopyNode(dbobject, 2);
+
+    (void) xmlUnsetProp(result, (xmlChar *) "fingerprint");
+    return result;
+}
+
+/* Add diffs for the dbobject children of contents1 and contents2, which
+ * belong to dbobjects with the same fingerprint, to result_parent.  The
+ * children are identical and appear in the same order, so they are
+ * paired by position rather than matched by key, and each pair is
+ * itself the same.  Nothing here can differ, except that a dbobject for
+ * which there are no diff rules is still reported as unknown. */
+static void
+processSameDiffs(
+    xmlNode *contents1, 
+    xmlNode *contents2, 
+    Hash *rules,
+    xmlNode *result_parent,
+    boolean *has_diffs)
+{
+    xmlNode *dbobj1 = getDbobject(contents1->children);
+    xmlNode *dbobj2 = getDbobject(contents2->children);
+    xmlNode *content = contentsNodeForDbobject(result_parent);
+    boolean diffs;
+
+    while (dbobj1 && dbobj2) {
+	diffs = FALSE;
+	xmlAddChild(content, diffPair(dbobj1, dbobj2, rules, &diffs));
+	if (diffs) {
+	    *has_diffs = TRUE;
+	}
+	dbobj1 = getDbobject(dbobj1->next);
+	dbobj2 = getDbobject(dbobj2->next);
+    }
+}
+
 static xmlNode *
 diffPair(xmlNode *dbobject1, xmlNode *dbobject2, 
 	 Hash *rules, boolean *diffs)
@@ -1095,15 +1254,16 @@ diffPair(xmlNode *dbobject1, xmlNode *dbobject2,
     boolean kids_differ = FALSE;
     DiffType difftype;
     boolean  do_rebuild = FALSE;
+    boolean  same = sameFingerprint(dbobject1, dbobject2);
 
-    if (ruleset = rulesetForNode(dbobject1, rules)) {
+    if ((ruleset = rulesetForNode(dbobject1, rules)) && !same) {
 	difflist = elementDiffs(contents1, contents2, 
 				ruleset, &diffdeps, &do_rebuild);
     }
 
     BEGIN {
 
-	result = xmlCopyNode(dbobject2, 2);
+	result = copyDbobject(dbobject2);
 	addDepsForDiff(result, dbobject1, FALSE);
 	addDepsForDiff(result, dbobject2, TRUE);
 
@@ -1122,9 +1282,15 @@ diffPair(xmlNode *dbobject1, xmlNode *dbobject2,
 	content = copyContents(contents2);
 	(void) xmlAddChildList(result, content);
 
-	processDiffs(contents1? contents1->children: NULL, 
-		     contents2? contents2->children: NULL, 
-		     rules, result, &kids_differ);
+	if (same) {
+	    processSameDiffs(contents1, contents2, rules, 
+			     result, &kids_differ);
+	}
+	else {
+	    processDiffs(contents1? contents1->children: NULL, 
+			 contents2? contents2->children: NULL, 
+			 rules, result, &kids_differ);
+	}
     }
     EXCEPTION(ex) {
 	xmlFreeNode(result);
@@ -1169,7 +1335,7 @@ diffSingle(xmlNode *dbobject, DiffType difftype,
 
     *diffs = TRUE;
     BEGIN {
-	result = xmlCopyNode(dbobject, 2);
+	result = copyDbobject(dbobject);
 	addNodeDeps(result, dbobject); 
 	context = copyContext(dbobject, NULL);
 	(void) xmlAddChildList(result, context);
@@ -1214,6 +1380,19 @@ dbobjectDiff(xmlNode *dbobject1, xmlNode *dbobject2,
     return NULL;
 }
 
+/* Free a source dbobject once its diff has been built.  Everything
+ * that the result needs has been copied from it, so by freeing each
+ * subtree as soon as it has been diffed, rather than with its
+ * document, the source documents shrink as the result grows.  */
+static void
+releaseDbobject(xmlNode *dbobject)
+{
+    if (dbobject) {
+	xmlUnlinkNode(dbobject);
+	xmlFreeNode(dbobject);
+    }
+}
+
 static Object *
 recordDroppedObj(Cons *entry, Object *param)
 {
@@ -1224,6 +1403,8 @@ recordDroppedObj(Cons *entry, Object *param)
     xmlNode *new;
     new = dbobjectDiff(((Node *) elem)->node, NULL, rules, &diffs);
     (void) xmlAddChild(parent->node, new);
+    releaseDbobject(((Node *) elem)->node);
+    ((Node *) elem)->node = NULL;
 
     return elem;
 }
@@ -1285,6 +1466,7 @@ processDiffs(
 {
     Hash *volatile node1objects = NULL;
     xmlNode *dbobj2 = getNextNode(node2);
+    xmlNode *next;
     xmlNode *match;
     xmlNode *difflist = NULL;
     xmlNode *content;
@@ -1296,6 +1478,7 @@ processDiffs(
 
 	while (dbobj2 = getDbobject(dbobj2)) {
 	    diffs = FALSE;
+	    next = dbobj2->next;
 	    match = getMatch(dbobj2, node1objects, rules);
 
 	    if (difflist = dbobjectDiff(match, dbobj2, rules, &diffs)) {
@@ -1304,7 +1487,9 @@ processDiffs(
 	    if (diffs) {
 		*has_diffs = TRUE;
 	    }
-	    dbobj2 = dbobj2->next;
+	    releaseDbobject(match);
+	    releaseDbobject(dbobj2);
+	    dbobj2 = next;
 	}
 	processRemaining(node1objects, rules, content, &diffs);
     }
@@ -1391,19 +1576,16 @@ depIsOnRebuild(xmlNode *depnode, Hash *hash)
 static boolean
 checkFollowedNode(DagNode *node, Hash *hash)
 {
-    String *follows = nodeAttribute(node->dbobject, "follow");
     DagNode *followee;
     boolean result = FALSE;
 
-    if (follows) {
-	if (followee = (DagNode *) dereference(hashGet(hash, 
-						       (Object *) follows))) 
+    if (node->follow) {
+	if (followee = (DagNode *) dereference(
+		hashGet(hash, (Object *) node->follow))) 
 	{
 	    assertDagNode(followee);
 	    result = checkRebuild(followee, hash);
 	}
-
-	objectFree((Object *) follows, TRUE);
     }
     return result;
 }
@@ -1440,12 +1622,11 @@ dependsOnRebuild(DagNode *node, Hash *hash)
 static void
 promoteNodeParent(DagNode *node, Hash *hash)
 {
-    String *parent_fqn = nodeAttribute(node->dbobject, "parent");
     DagNode *parent_node;
     String *diff;
-    if (parent_fqn) {
+    if (node->parent_fqn) {
 	parent_node = (DagNode *) 
-	    dereference(hashGet(hash, (Object *) parent_fqn));
+	    dereference(hashGet(hash, (Object *) node->parent_fqn));
 	assertDagNode(parent_node);
 
 	if (diff = nodeAttribute(parent_node->dbobject, "diff")) {
@@ -1458,7 +1639,6 @@ promoteNodeParent(DagNode *node, Hash *hash)
 	    objectFree((Object *) diff, TRUE);
 	}
     }
-    objectFree((Object *) parent_fqn, TRUE);
 }
 
 static void
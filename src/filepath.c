@@ -27,37 +27,236 @@
 #include <dirent.h>
 
 
-static glob_t glob_buf;
-static int glob_buf_idx = 0;
-static boolean glob_buf_freed = TRUE;
+/* The set of paths matched by the most recent call to get_matches(),
+ * returned in turn by next_match().  The array is NULL-terminated. */
+static char **match_v = NULL;
+static int match_count = 0;
+static int match_size = 0;
+static int match_idx = 0;
+
+/* Directory index.  Locating a file involves looking in up to four
+ * places for each of the template paths, and the same directories are
+ * searched many times during a single run.  Rather than using glob()
+ * for each lookup, each directory is read once, on first use, and
+ * recorded in dir_index keyed by its path.  Each entry has the form:
+ * (entries . subdirs), where entries is a Hash of the names in the
+ * directory, each mapped to an Int4 which is 1 for a subdirectory and
+ * 0 otherwise, and subdirs is a sorted Vector of the names of its
+ * subdirectories.  Paths containing wildcard characters, or ~, are
+ * still handled by glob().  The template directories are not expected
+ * to change while skit is running.
+ */
+static Hash *dir_index = NULL;
+
+/* The paths found by pathToFile() keyed by all of its parameters.
+ * Only successful searches are recorded.  A failed search is cheap to
+ * repeat from dir_index, and there is nothing to be gained by
+ * keeping an entry for every name that was merely probed for. */
+static Hash *path_cache = NULL;
 
 static void
 freeGlobBuf()
 {
-    if (!glob_buf_freed) {
-	globfree(&glob_buf);
+    while (match_count > 0) {
+	skfree(match_v[--match_count]);
+    }
+    if (match_v) {
+	match_v[0] = NULL;
+    }
+    match_idx = 0;
+}
+
+static void
+addMatch(char *path)
+{
+    if (match_count + 1 >= match_size) {
+	match_size += 16;
+	if (match_v) {
+	    match_v = skrealloc(match_v, match_size * sizeof(char *));
+	}
+	else {
+	    match_v = skalloc(match_size * sizeof(char *));
+	}
     }
+    match_v[match_count++] = newstr("%s", path);
+    match_v[match_count] = NULL;
 }
 
+void
+freeFilepathIndex()
+{
+    freeGlobBuf();
+    if (match_v) {
+	skfree(match_v);
+	match_v = NULL;
+    }
+    match_size = 0;
+    objectFree((Object *) dir_index, TRUE);
+    objectFree((Object *) path_cache, TRUE);
+    dir_index = NULL;
+    path_cache = NULL;
+}
+
+static boolean
+hasWildcards(char *path)
+{
+    return strpbrk(path, "*?[~") != NULL;
+}
+
+static boolean
+isDirectory(char *dirpath, struct dirent *direntry)
+{
+    char *path;
+    struct stat statbuf;
+    boolean result;
+
+    if ((direntry->d_type != DT_UNKNOWN) && (direntry->d_type != DT_LNK)) {
+	return direntry->d_type == DT_DIR;
+    }
+    path = newstr("%s/%s", dirpath, direntry->d_name);
+    result = (stat(path, &statbuf) == 0) && S_ISDIR(statbuf.st_mode);
+    skfree(path);
+    return result;
+}
+
+/* Return the dir_index entry for dirpath, reading the directory if it
+ * has not previously been seen.  A directory that cannot be read is
+ * recorded as having no entries. */
+static Cons *
+dirIndexEntry(char *dirpath)
+{
+    String key = {OBJ_STRING, dirpath};
+    Cons *entry;
+    Hash *entries;
+    Vector *subdirs;
+    boolean is_dir;
+    DIR *dir;
+    struct dirent *direntry;
+
+    if (!dir_index) {
+	dir_index = hashNew(TRUE);
+    }
+    if (entry = (Cons *) hashGet(dir_index, (Object *) &key)) {
+	return entry;
+    }
+
+    entries = hashNew(TRUE);
+    subdirs = vectorNew(10);
+    if (dir = opendir(dirpath)) {
+	while (direntry = readdir(dir)) {
+	    if (streq(direntry->d_name, ".") || 
+		streq(direntry->d_name, "..")) {
+		continue;
+	    }
+	    is_dir = isDirectory(dirpath, direntry);
+	    hashAdd(entries, (Object *) stringNew(direntry->d_name), 
+		    (Object *) int4New(is_dir));
+	    if (is_dir) {
+		vectorPush(subdirs, (Object *) stringNew(direntry->d_name));
+	    }
+	}
+	closedir(dir);
+    }
+    vectorStringSort(subdirs);
+    entry = consNew((Object *) entries, (Object *) subdirs);
+    hashAdd(dir_index, (Object *) stringNew(dirpath), (Object *) entry);
+    return entry;
+}
+
+/* Use the directory index to determine whether path exists. */
+static boolean
+pathExists(char *path)
+{
+    char *slash = strrchr(path, '/');
+    char *dirpath;
+    String name;
+    Cons *entry;
+    struct stat statbuf;
+    boolean result;
+
+    if (!slash) {
+	dirpath = newstr(".");
+	name.value = path;
+    }
+    else if (slash == path) {
+	dirpath = newstr("/");
+	name.value = slash + 1;
+    }
+    else {
+	dirpath = newstr("%.*s", (int) (slash - path), path);
+	name.value = slash + 1;
+    }
+    name.type = OBJ_STRING;
+
+    if (*name.value == '\0') {
+	/* path names a directory. */
+	result = (stat(dirpath, &statbuf) == 0) && S_ISDIR(statbuf.st_mode);
+    }
+    else {
+	entry = dirIndexEntry(dirpath);
+	result = hashGet((Hash *) entry->car, (Object *) &name) != NULL;
+    }
+    skfree(dirpath);
+    return result;
+}
 
-// Use glob to get an array of filepaths matching path.  Return the
-// count of filepaths
+// Get an array of filepaths matching path.  Return the count of
+// filepaths.  Only paths containing wildcards need glob.
 static int
 get_matches(char *path)
 {
+    glob_t glob_buf;
+    size_t i;
+
     freeGlobBuf();
-    glob(path, GLOB_TILDE, NULL, &glob_buf);
-    glob_buf_freed = FALSE;
-    glob_buf_idx = 0;
-    //fprintf(stderr, "LOOKING IN: %s  (%d)\n", path, glob_buf.gl_pathc);
-    return glob_buf.gl_pathc;
+    if (!hasWildcards(path)) {
+	if (pathExists(path)) {
+	    addMatch(path);
+	}
+    }
+    else {
+	glob(path, GLOB_TILDE, NULL, &glob_buf);
+	for (i = 0; i < glob_buf.gl_pathc; i++) {
+	    addMatch(glob_buf.gl_pathv[i]);
+	}
+	globfree(&glob_buf);
+    }
+    //fprintf(stderr, "LOOKING IN: %s  (%d)\n", path, match_count);
+    return match_count;
+}
+
+// Get the filepaths matching dirpath/*/filename, using the directory
+// index.  Return the count of filepaths.
+static int
+get_subdir_matches(char *dirpath, char *filename)
+{
+    Vector *subdirs;
+    String *subdir;
+    char *path;
+    int i;
+
+    freeGlobBuf();
+    subdirs = (Vector *) dirIndexEntry(dirpath)->cdr;
+    EACH(subdirs, i) {
+	subdir = (String *) ELEM(subdirs, i);
+	if (subdir->value[0] == '.') {
+	    /* As with glob, * does not match hidden directories. */
+	    continue;
+	}
+	path = newstr("%s/%s/%s", dirpath, subdir->value, filename);
+	if (pathExists(path)) {
+	    addMatch(path);
+	}
+	skfree(path);
+    }
+    return match_count;
 }
 
 // Return the next filepath set up by get_matches.
 static char *
 next_match()
 {
-    return glob_buf.gl_pathv[glob_buf_idx++];
+    return match_v? match_v[match_idx++]: NULL;
 }
 
 
@@ -137,8 +336,15 @@ locateFile(char *path, char *templatedir, char *dbdir, char *filename)
 	return -1;
     }
 
-    mypath = newstr("%s/%s/%s/*/%s", path, templatedir, dbdir, filename);
-    count = get_matches(mypath);
+    mypath = newstr("%s/%s/%s", path, templatedir, dbdir);
+    if (hasWildcards(mypath) || hasWildcards(filename)) {
+	skfree(mypath);
+	mypath = newstr("%s/%s/%s/*/%s", path, templatedir, dbdir, filename);
+	count = get_matches(mypath);
+    }
+    else {
+	count = get_subdir_matches(mypath, filename);
+    }
     skfree(mypath);
     return count;
 }
@@ -189,9 +395,9 @@ versionFromMatch(char *filepath, char *filename)
 //    root/templatedir/dbdir/version
 // If more than one is found in root/sub/version, then we return 
 // the match with the highest version <= our version parameter
-char *
-pathToFile(Vector *roots, String *templatedir, String *dbdir, 
-	   Object *version, String *filename)
+static char *
+searchForFile(Vector *roots, String *templatedir, String *dbdir, 
+	      Object *version, String *filename)
 {
     String *root;
     char *match;                  // Contains string managed by glob
@@ -275,6 +481,40 @@ pathToFile(Vector *roots, String *templatedir, String *dbdir,
     return NULL;
 }
 
+// As searchForFile() but the result of each successful search is
+// remembered, so that each file is only located once.
+char *
+pathToFile(Vector *roots, String *templatedir, String *dbdir, 
+	   Object *version, String *filename)
+{
+    char *roots_str = objectSexp((Object *) roots);
+    char *version_str = objectSexp(version);
+    String *key;
+    Object *found;
+    char *result;
+
+    key = stringNewByRef(newstr("%s|%s|%s|%s|%s", roots_str, 
+				templatedir->value, dbdir->value,
+				version_str, filename->value));
+    skfree(roots_str);
+    skfree(version_str);
+    if (!path_cache) {
+	path_cache = hashNew(TRUE);
+    }
+    if (found = hashGet(path_cache, (Object *) key)) {
+	objectFree((Object *) key, TRUE);
+	return newstr("%s", ((String *) found)->value);
+    }
+
+    if (result = searchForFile(roots, templatedir, dbdir, version, filename)) {
+	hashAdd(path_cache, (Object *) key, (Object *) stringNew(result));
+    }
+    else {
+	objectFree((Object *) key, TRUE);
+    }
+    return result;
+}
+
 /* Simpler interface to above, using built-in symbols to provide the
  * fixed(-ish) parameters. */
 String *
@@ -500,6 +500,259 @@ checkChunk(void *chunk, void *check_for)
 
 #endif
 
+/* Arenas allow groups of objects with a common lifetime to be
+ * allocated from large blocks of memory and released together in a
+ * single operation.  Once an arena has been started with arenaBegin(),
+ * skallocArena() allocates from it until the matching arenaEnd().
+ * Calls to skfree() for memory within an active arena do nothing; the
+ * memory is reclaimed when the arena ends.  It is up to the caller to
+ * ensure that nothing allocated from an arena outlives it.
+ *
+ * Since skfree() must check every pointer it is given against the
+ * active arenas, arena blocks are aligned to, and sized in multiples
+ * of, ARENA_PAGE bytes.  The arena owning each such page is recorded
+ * in arena_pages, so ownership can be determined with a single lookup
+ * regardless of how many blocks the arenas have grown to.
+ *
+ * With MEM_DEBUG, each arena chunk is preceded by a header so that
+ * chunks can be tracked individually, just like those from skalloc().
+ * Chunks that have not been freed by arenaEnd() are reported, as
+ * anything still referring to them will be left dangling, and are
+ * then forgotten.
+ */
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK (64 * 1024)
+#define ARENA_MAX_BLOCK (4 * 1024 * 1024)
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_PAGE_BITS 16
+#define ARENA_PAGE ((size_t) 1 << ARENA_PAGE_BITS)
+#define ARENA_PAGE_ROUND(x) (((x) + ARENA_PAGE - 1) & ~(ARENA_PAGE - 1))
+#define ARENA_PAGE_KEY(p) GSIZE_TO_POINTER(((size_t) (p)) >> ARENA_PAGE_BITS)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    char              *data;
+    size_t             size;
+    size_t             used;
+} ArenaBlock;
+
+#ifdef MEM_DEBUG
+typedef struct ArenaChunk {
+    size_t  size;
+    boolean live;
+} ArenaChunk;
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaChunk))
+#else
+#define ARENA_HEADER 0
+#endif
+
+struct Arena {
+    ArenaBlock   *blocks;
+    size_t        next_block_size;
+    struct Arena *prev;
+#ifdef MEM_DEBUG
+    int           chunks_in_use;
+#endif
+};
+
+static Arena *cur_arena = NULL;
+
+/* Maps each ARENA_PAGE of memory within an active arena's blocks to the
+ * arena that owns it.
+ */
+static GHashTable *arena_pages = NULL;
+
+/* Record (or with a NULL arena, forget) the ownership of each page of
+ * block.
+ */
+static void
+arenaPagesSet(ArenaBlock *block, Arena *arena)
+{
+    char *page = (char *) block;
+    char *end = block->data + block->size;
+
+    for (; page < end; page += ARENA_PAGE) {
+	if (arena) {
+	    g_hash_table_insert(arena_pages, ARENA_PAGE_KEY(page), arena);
+	}
+	else {
+	    g_hash_table_remove(arena_pages, ARENA_PAGE_KEY(page));
+	}
+    }
+}
+
+static ArenaBlock *
+arenaBlockNew(Arena *arena, size_t min_size)
+{
+    size_t size = arena->next_block_size;
+    ArenaBlock *block;
+    void *mem;
+
+    if (size < min_size) {
+	size = min_size;
+    }
+    if (arena->next_block_size < ARENA_MAX_BLOCK) {
+	arena->next_block_size *= 2;
+    }
+    size = ARENA_PAGE_ROUND(ARENA_ROUND(sizeof(ArenaBlock)) + size);
+    if (posix_memalign(&mem, ARENA_PAGE, size)) {
+	RAISE(MEMORY_ERROR, 
+	      newstr("arenaBlockNew: unable to allocate %ld bytes", 
+		     (long) size));
+    }
+    block = (ArenaBlock *) mem;
+    block->data = ((char *) block) + ARENA_ROUND(sizeof(ArenaBlock));
+    block->size = size - ARENA_ROUND(sizeof(ArenaBlock));
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    if (!arena_pages) {
+	arena_pages = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    arenaPagesSet(block, arena);
+    return block;
+}
+
+/* Return the active arena, if any, containing ptr.  Only arena chunks
+ * can lie within an arena block's pages, so the page alone tells us.
+ */
+static Arena *
+arenaOwner(void *ptr)
+{
+    if (!arena_pages) {
+	return NULL;
+    }
+    return (Arena *) g_hash_table_lookup(arena_pages, ARENA_PAGE_KEY(ptr));
+}
+
+/* If ptr belongs to an active arena, record that it has been freed
+ * and return TRUE.  The memory itself is not reclaimed until the arena
+ * is ended.
+ */
+static boolean
+arenaRelease(void *ptr)
+{
+    Arena *arena = arenaOwner(ptr);
+
+    if (!arena) {
+	return FALSE;
+    }
+#ifdef MEM_DEBUG
+    skforget(ptr);
+    ((ArenaChunk *) (((char *) ptr) - ARENA_HEADER))->live = FALSE;
+    arena->chunks_in_use--;
+#endif
+    return TRUE;
+}
+
+/* Start a new arena.  Until arenaEnd() is called, all allocations
+ * made through skallocArena() will come from this arena.
+ */
+Arena *
+arenaBegin()
+{
+    Arena *arena = (Arena *) malloc(sizeof(Arena));
+
+    if (!arena) {
+	RAISE(MEMORY_ERROR, newstr("arenaBegin: unable to allocate arena"));
+    }
+    arena->blocks = NULL;
+    arena->next_block_size = ARENA_MIN_BLOCK;
+    arena->prev = cur_arena;
+#ifdef MEM_DEBUG
+    arena->chunks_in_use = 0;
+#endif
+    cur_arena = arena;
+    return arena;
+}
+
+#ifdef MEM_DEBUG
+/* Return the number of chunks allocated from arena that have not been
+ * freed.
+ */
+int
+arenaChunksInUse(Arena *arena)
+{
+    return arena->chunks_in_use;
+}
+#endif
+
+/* Release an arena, and everything allocated from it, in one go.
+ * Arenas must be ended in the reverse order to which they were begun.
+ */
+void
+arenaEnd(Arena *arena)
+{
+    ArenaBlock *block;
+
+    if (arena != cur_arena) {
+	RAISE(MEMORY_ERROR, 
+	      newstr("arenaEnd: arena %p is not the current arena", arena));
+    }
+    cur_arena = arena->prev;
+#ifdef MEM_DEBUG
+    if (arenaChunksInUse(arena)) {
+	fprintf(stderr, "arenaEnd: %d chunks not freed from arena %p\n", 
+		arenaChunksInUse(arena), arena);
+    }
+#endif
+    while (block = arena->blocks) {
+#ifdef MEM_DEBUG
+	size_t offset = 0;
+	ArenaChunk *chunk;
+	while (offset < block->used) {
+	    chunk = (ArenaChunk *) (block->data + offset);
+	    if (chunk->live) {
+		fprintf(stderr, "  Arena chunk %p not freed\n", 
+			((char *) chunk) + ARENA_HEADER);
+		skforget(((char *) chunk) + ARENA_HEADER);
+	    }
+	    offset += ARENA_HEADER + chunk->size;
+	}
+#endif
+	arena->blocks = block->next;
+	arenaPagesSet(block, NULL);
+	free(block);
+    }
+    free(arena);
+    if (!cur_arena && arena_pages) {
+	g_hash_table_destroy(arena_pages);
+	arena_pages = NULL;
+    }
+}
+
+/* Allocate memory from the current arena, or using skallocSmall() if
+ * there is no current arena.  Memory from here must be freed using
+ * skfreeSmall().
+ */
+void *
+skallocArena(size_t size)
+{
+    Arena *arena = cur_arena;
+    ArenaBlock *block;
+    char *result;
+
+    if (!arena) {
+	return skallocSmall(size);
+    }
+    size = size? ARENA_ROUND(size): ARENA_ALIGN;
+    block = arena->blocks;
+    if (!block || ((block->size - block->used) < (size + ARENA_HEADER))) {
+	block = arenaBlockNew(arena, size + ARENA_HEADER);
+    }
+    result = block->data + block->used;
+    block->used += size + ARENA_HEADER;
+#ifdef MEM_DEBUG
+    ((ArenaChunk *) result)->size = size;
+    ((ArenaChunk *) result)->live = TRUE;
+    result += ARENA_HEADER;
+    arena->chunks_in_use++;
+    memchunks_incr(result);
+#endif
+    return (void *) result;
+}
+
 void *
 skalloc(size_t size)
 {
@@ -512,6 +765,9 @@ skalloc(size_t size)
 void 
 skfree(void *ptr)
 {
+    if (cur_arena && arenaRelease(ptr)) {
+	return;
+    }
 #ifdef MEM_DEBUG
     skforget(ptr);
 #endif
@@ -531,6 +787,175 @@ skrealloc(void *p, size_t size)
     return result;
 }
 
+/* Small objects of fixed size (conses, strings, int4s, references and
+ * dependency graph objects) are allocated from per-size-class pools
+ * rather than individually from malloc.  Each pool carves its objects
+ * out of cache-line aligned slabs and keeps a free list of released
+ * objects for reuse.  Since skfree() is not told the size of what it
+ * is freeing, pooled objects must be released with skfreeSmall(),
+ * giving the same size as was passed to skallocSmall().
+ *
+ * With MEM_DEBUG, pooled objects are tracked exactly as those from
+ * skalloc() are.
+ */
+
+#define POOL_CACHE_LINE 64
+#define POOL_SLAB_SIZE (64 * 1024)
+#define POOL_GRANULE 16
+#define POOL_CLASSES 8
+#define POOL_MAX_SIZE (POOL_GRANULE * POOL_CLASSES)
+
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+} PoolSlab;
+
+typedef struct PoolFreeItem {
+    struct PoolFreeItem *next;
+} PoolFreeItem;
+
+typedef struct Pool {
+    PoolFreeItem *free_list;
+    PoolSlab     *slabs;
+    char         *next;
+    char         *end;
+    long          slab_count;
+    long          allocs;
+    long          frees;
+    long          in_use;
+    long          max_in_use;
+} Pool;
+
+static Pool pools[POOL_CLASSES];
+
+static void
+poolNewSlab(Pool *pool)
+{
+    void *mem;
+    PoolSlab *slab;
+
+    if (posix_memalign(&mem, POOL_CACHE_LINE, POOL_SLAB_SIZE)) {
+	RAISE(MEMORY_ERROR, 
+	      newstr("poolNewSlab: unable to allocate slab"));
+    }
+    slab = (PoolSlab *) mem;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+    /* The first cache line holds the slab header. */
+    pool->next = ((char *) mem) + POOL_CACHE_LINE;
+    pool->end = ((char *) mem) + POOL_SLAB_SIZE;
+}
+
+/* Allocate size bytes, from a pool if size is small enough.
+ */
+void *
+skallocSmall(size_t size)
+{
+    Pool *pool;
+    size_t chunk_size;
+    void *result;
+
+    if ((size == 0) || (size > POOL_MAX_SIZE)) {
+	return skalloc(size);
+    }
+    pool = &pools[(size - 1) / POOL_GRANULE];
+    if (pool->free_list) {
+	result = (void *) pool->free_list;
+	pool->free_list = pool->free_list->next;
+    }
+    else {
+	chunk_size = ((size - 1) / POOL_GRANULE + 1) * POOL_GRANULE;
+	if (pool->next + chunk_size > pool->end) {
+	    poolNewSlab(pool);
+	}
+	result = (void *) pool->next;
+	pool->next += chunk_size;
+    }
+    pool->allocs++;
+    if (++pool->in_use > pool->max_in_use) {
+	pool->max_in_use = pool->in_use;
+    }
+    memchunks_incr(result);
+    return result;
+}
+
+/* Free memory allocated by skallocSmall().  Size must be the same as
+ * was given when the memory was allocated.
+ */
+void
+skfreeSmall(void *ptr, size_t size)
+{
+    Pool *pool;
+    PoolFreeItem *item;
+
+    if (!ptr) {
+	return;
+    }
+    if (cur_arena && arenaRelease(ptr)) {
+	return;
+    }
+    if ((size == 0) || (size > POOL_MAX_SIZE)) {
+	skfree(ptr);
+	return;
+    }
+#ifdef MEM_DEBUG
+    skforget(ptr);
+#endif
+    pool = &pools[(size - 1) / POOL_GRANULE];
+    item = (PoolFreeItem *) ptr;
+    item->next = pool->free_list;
+    pool->free_list = item;
+    pool->frees++;
+    pool->in_use--;
+}
+
+/* Print usage statistics for each pool to stderr.  After
+ * skitFreeMem(), only pools with objects still in use are shown, so
+ * this is part of the MEM_DEBUG report of unfreed memory at shutdown.
+ */
+void
+showPoolStats()
+{
+    int i;
+    Pool *pool;
+
+    fprintf(stderr, "%6s %8s %12s %12s %10s %10s\n", "size", "slabs", 
+	    "allocs", "frees", "in use", "max used");
+    for (i = 0; i < POOL_CLASSES; i++) {
+	pool = &pools[i];
+	if (pool->slab_count) {
+	    fprintf(stderr, "%6d %8ld %12ld %12ld %10ld %10ld\n", 
+		    (i + 1) * POOL_GRANULE, pool->slab_count, pool->allocs, 
+		    pool->frees, pool->in_use, pool->max_in_use);
+	}
+    }
+}
+
+/* Return the slabs of any pools that are no longer in use to the
+ * system.
+ */
+static void
+freePools()
+{
+    int i;
+    Pool *pool;
+    PoolSlab *slab;
+
+    for (i = 0; i < POOL_CLASSES; i++) {
+	pool = &pools[i];
+	if (pool->in_use == 0) {
+	    while (slab = pool->slabs) {
+		pool->slabs = slab->next;
+		free(slab);
+	    }
+	    pool->free_list = NULL;
+	    pool->next = NULL;
+	    pool->end = NULL;
+	    pool->slab_count = 0;
+	}
+    }
+}
+
 void
 skitFreeMem()
 {
@@ -541,13 +966,14 @@ skitFreeMem()
     }
 
     documentFreeMem();
+    freeFilepathIndex();
     pgsqlFreeMem();
     freeSkitProcessors();
-    freeStdTemplates();
     xsltCleanupGlobals();
     xmlCleanupParser();
     freeOptions();
     freeSymbolTable();
+    freePools();
 }
 
 
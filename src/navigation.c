@@ -45,9 +45,8 @@ findContextNode(xmlNode *node)
  * falls on, based on its action attribute.
  */
 static DependencyApplication
-buildDirection(xmlNode *dbobject)
+buildDirection(String *action)
 {
-    String *action = nodeAttribute(dbobject, "action");
     DependencyApplication result = UNKNOWN_DIRECTION;
 
     assert(action, "Expected action attribute for dbobject node");
@@ -67,7 +66,6 @@ buildDirection(xmlNode *dbobject)
     else {
 	RAISE(GENERAL_ERROR, newstr("Unknown action: %s", action->value));
     }
-    objectFree((Object *) action, TRUE);
     return result;
 }
 
@@ -94,16 +92,14 @@ contextApplies(
 }
 
 static Cons *
-getContexts(xmlNode *node)
+getContexts(xmlNode *node, DependencyApplication build_direction)
 {
     xmlNode *context_node;
     Context *context;
     Cons *result = NULL;
-    DependencyApplication build_direction;
     DependencyApplication context_direction;
 
     if (node) {
-	build_direction = buildDirection(node);
 	context_node = node;
 	while (context_node = findContextNode(context_node)) {
 	    context = contextNew(nodeAttribute(context_node, "type"),
@@ -164,23 +160,90 @@ contextMatch(Object *ctx1, Object *ctx2)
 		 ((Context *) ctx1)->context_type->value);
 }
 
+/* The navigation pass walks the sorted dbobject nodes in order,
+ * keeping a NavPosition for the node being navigated from and the node
+ * being navigated to.  Each position records the node's action, its
+ * contexts and its ancestry, so that these are computed only once for
+ * each node rather than once for each navigation step in which it
+ * takes part.  The ancestry vector is re-used from node to node.
+ */
+typedef struct NavPosition {
+    Node    *node;
+    String  *action;
+    Cons    *contexts;
+    Vector  *ancestry;   /* Canonical nodes, from node up to the root */
+} NavPosition;
+
+/* Nodes are identified by fqn.  A dbobject may appear more than once
+ * in the sorted vector (eg to be dropped and then rebuilt), so the
+ * canonical node for an fqn is the one recorded in the byfqn hash.
+ * Parent links always refer to canonical nodes, so comparing canonical
+ * node pointers is equivalent to comparing fqns.
+ */
+static Node *
+canonicalNode(Node *node, Hash *byfqn)
+{
+    String *fqn = nodeAttribute(node->node, "fqn");
+    Node *result = (Node *) hashGet(byfqn, (Object *) fqn);
+
+    objectFree((Object *) fqn, TRUE);
+    return result;
+}
+
+static void
+clearNavPosition(NavPosition *pos)
+{
+    objectFree((Object *) pos->action, TRUE);
+    objectFree((Object *) pos->contexts, TRUE);
+    pos->node = NULL;
+    pos->action = NULL;
+    pos->contexts = NULL;
+    if (pos->ancestry) {
+	pos->ancestry->elems = 0;
+    }
+}
+
+static void
+setNavPosition(NavPosition *pos, Node *node, Hash *byfqn)
+{
+    Node *ancestor;
+
+    clearNavPosition(pos);
+    pos->node = node;
+    pos->action = nodeAttribute(node->node, "action");
+    pos->contexts = getContexts(node->node, buildDirection(pos->action));
+    if (!pos->ancestry) {
+	pos->ancestry = vectorNew(10);
+    }
+    vectorPush(pos->ancestry, (Object *) canonicalNode(node, byfqn));
+    for (ancestor = node->parent; ancestor; ancestor = ancestor->parent) {
+	vectorPush(pos->ancestry, (Object *) ancestor);
+    }
+}
+
 static Cons *
-getContextNavigation(xmlNode *from, xmlNode *target)
+getContextNavigation(Cons *from_contexts, Cons *target_contexts)
 {
-    Cons *from_contexts;
-    Cons *target_contexts;
+    Cons *unmatched = NULL;
+    Cons **p_last = &unmatched;
+    Cons *this;
     Context *target_context;
     Context *from_context;
     Vector *departures = vectorNew(10);
     Vector *arrivals = vectorNew(10);
     Cons *result = consNew((Object *) departures, (Object *) arrivals);
 
-    /* Contexts are lists of the form: (type value default) */
-    from_contexts = getContexts(from);
-    target_contexts = getContexts(target);
-    while (target_contexts) {
-	target_context = (Context *) consPop(&target_contexts);
-	from_context = (Context *) listExtract(&from_contexts, 
+    /* Contexts are lists of the form: (type value default).  They
+     * belong to their NavPositions, so we match against a copy of the
+     * from list, which shares its Context objects.  */
+    for (this = from_contexts; this; this = (Cons *) this->cdr) {
+	*p_last = consNew(this->car, NULL);
+	p_last = (Cons **) &((*p_last)->cdr);
+    }
+
+    for (this = target_contexts; this; this = (Cons *) this->cdr) {
+	target_context = (Context *) this->car;
+	from_context = (Context *) listExtract(&unmatched, 
 					       (Object *) target_context,
 					       &contextMatch);
 
@@ -199,147 +262,117 @@ getContextNavigation(xmlNode *from, xmlNode *target)
 	    /* This is a new context. */
 	    addContext(arrivals, target_context);
 	}
-	objectFree((Object *) from_context, TRUE);
-	objectFree((Object *) target_context, TRUE);
     }
 
     /* Close the final contexts.  */
-    while (from_contexts) {
-	from_context = (Context *) consPop(&from_contexts);
+    while (unmatched) {
+	from_context = (Context *) consPop(&unmatched);
 	addContext(departures, from_context);
-	objectFree((Object *) from_context, TRUE);
     }
 
     return result;
 }
 
-
-static boolean
-nodesMatch(Node *node1, Node *node2)
+/* Return the index in pos's ancestry of ancestor, or the length of
+ * the ancestry if ancestor is NULL or is not found. */
+static int
+ancestryIndex(NavPosition *pos, Node *ancestor)
 {
-    String *node1_fqn;
-    String *node2_fqn;
-    boolean result = FALSE;
-    if (node1 && node2) {
-	node1_fqn = nodeAttribute(node1->node, "fqn"); 
-	node2_fqn = nodeAttribute(node2->node, "fqn");
-	result = streq(node1_fqn->value, node2_fqn->value);
-	objectFree((Object *) node1_fqn, TRUE);
-	objectFree((Object *) node2_fqn, TRUE);
+    int i;
+
+    EACH(pos->ancestry, i) {
+	if (ELEM(pos->ancestry, i) == (Object *) ancestor) {
+	    return i;
+	}
     }
-    return result;
+    return pos->ancestry->elems;
+}
+
+/* The node at index idx of pos's ancestry, from which a navigation
+ * node will be copied.  Index 0 is the position's own node which may
+ * not be the canonical node for its fqn. */
+static Node *
+ancestryNode(NavPosition *pos, int idx)
+{
+    return idx? (Node *) ELEM(pos->ancestry, idx): pos->node;
 }
 
 /* Add departure navigation nodes to the departures vector. */
 static void
-departFrom(Node *nav_from, Node *ancestor, Vector *departures)
+departFrom(NavPosition *nav_from, Node *ancestor, Vector *departures)
 {
-    Node *this_node;
+    /* We do not depart from a node we are dropping. */
+    int first = streq(nav_from->action->value, "drop")? 1: 0;
+    int stop = ancestryIndex(nav_from, ancestor);
+    int i;
     xmlNode *new;
-    Node *nav_node;
-    String *action = nodeAttribute(nav_from->node, "action");
 
-    if (streq(action->value, "drop")) {
-	/* We do not depart from a node we are dropping. */
-	this_node = nav_from->parent;
-	
-    }
-    else {
-	this_node = nav_from;
-    }
-    while (this_node && !nodesMatch(this_node, ancestor)) {
+    for (i = first; i < stop; i++) {
 	/* Add a departure from this into our departures vector. */
-	new = xmlCopyNode(this_node->node, 2);
-	nav_node = nodeNew(new);
-	vectorPush(departures, (Object *) nav_node);
-
-	this_node = this_node->parent;
+	new = xmlCopyNode(ancestryNode(nav_from, i)->node, 2);
+	vectorPush(departures, (Object *) nodeNew(new));
     }
-    objectFree((Object *) action, TRUE);
 }
 
-/* Add arrival navigation nodes to the arrivals vector. */
+/* Add arrival navigation nodes to the arrivals vector.  Arrivals are
+ * ordered from the outermost node inwards, and precede any context
+ * arrivals already in the vector. */
 static void
-arriveAt(Node *nav_to, Node *ancestor, Vector *arrivals)
+arriveAt(NavPosition *nav_to, Node *ancestor, Vector *arrivals)
 {
-    Node *this_node;
+    /* We do not arrive at a node we are building. */
+    int first = streq(nav_to->action->value, "build")? 1: 0;
+    int stop = ancestryIndex(nav_to, ancestor);
+    int idx = 0;
+    int i;
     xmlNode *new;
-    Node *nav_node;
-    String *action = nodeAttribute(nav_to->node, "action");
-
-    if (streq(action->value, "build")) {
-	/* We do not arrive at a node we are building. */
-	this_node = nav_to->parent;
-	
-    }
-    else {
-	this_node = nav_to;
-    }
 
-    while (this_node && !nodesMatch(this_node, ancestor)) {
+    for (i = stop - 1; i >= first; i--) {
 	/* Add an arrival to this into our arrivals vector. */
-	new = xmlCopyNode(this_node->node, 2);
-	nav_node = nodeNew(new);
-	vectorInsert(arrivals, (Object *) nav_node, 0);
-
-	this_node = this_node->parent;
+	new = xmlCopyNode(ancestryNode(nav_to, i)->node, 2);
+	vectorInsert(arrivals, (Object *) nodeNew(new), idx++);
     }
-    objectFree((Object *) action, TRUE);
-}
-
-static Vector *
-ancestryStack(Node *node)
-{
-    Vector *result = vectorNew(10);
-    while (node) {
-	vectorPush(result, (Object *) node);
-	node = node->parent;
-    }
-    return result;
 }
 
+/* Find the deepest node shared by the ancestries of nav_from and
+ * nav_to, comparing from the root downwards. */
 static Node*
-commonAncestor(Node *nav_from, Node *nav_to)
+commonAncestor(NavPosition *nav_from, NavPosition *nav_to)
 {
     Node *result = NULL;
-    Vector *from_stack;
-    Vector *to_stack;
-    Node *ancestor;
-    Node *this;
+    int from_idx;
+    int to_idx;
 
     if (nav_from && nav_to) {
-	from_stack = ancestryStack(nav_from);
-	to_stack = ancestryStack(nav_to);
-	
-	while (ancestor = (Node *) vectorPop(from_stack)) {
-	    this = (Node *) vectorPop(to_stack);
-	    if (nodesMatch(ancestor, this)) {
-		result = ancestor;
-	    }
-	    else {
-		break;
-	    }
+	from_idx = nav_from->ancestry->elems - 1;
+	to_idx = nav_to->ancestry->elems - 1;
+	while ((from_idx >= 0) && (to_idx >= 0) &&
+	       (ELEM(nav_from->ancestry, from_idx) == 
+		ELEM(nav_to->ancestry, to_idx)))
+	{
+	    result = (Node *) ELEM(nav_from->ancestry, from_idx);
+	    from_idx--;
+	    to_idx--;
 	}
-
-	objectFree((Object *) from_stack, FALSE);
-	objectFree((Object *) to_stack, FALSE);
     }
     return result;
 }
 
 static void
 getNodeNavigation(
-    Node *nav_from, 
-    Node *nav_to, 
+    NavPosition *nav_from, 
+    NavPosition *nav_to, 
     Vector *arrivals,
     Vector *departures)
 {
     Node *common_ancestor = commonAncestor(nav_from, nav_to);
-    if (nav_from && !nodesMatch(nav_from, common_ancestor)) {
+    if (nav_from && 
+	(ELEM(nav_from->ancestry, 0) != (Object *) common_ancestor)) {
 	departFrom(nav_from, common_ancestor, departures);
     }
 
-    if (nav_to && !nodesMatch(nav_to, common_ancestor)) {
+    if (nav_to && 
+	(ELEM(nav_to->ancestry, 0) != (Object *) common_ancestor)) {
 	arriveAt(nav_to, common_ancestor, arrivals);
     }
 }
@@ -363,8 +396,8 @@ makeNodesHash(Vector *nodes)
 static void
 doAddNavigation(
     xmlNode *parent,
-    Node *nav_from, 
-    Node *nav_to)
+    NavPosition *nav_from, 
+    NavPosition *nav_to)
 {
     Cons *context_nav;
     Vector *volatile departures = NULL;
@@ -373,8 +406,8 @@ doAddNavigation(
     xmlNode *new;
     int i;
 
-    context_nav = getContextNavigation(nav_from? nav_from->node: NULL, 
-				       nav_to? nav_to->node: NULL);
+    context_nav = getContextNavigation(nav_from? nav_from->contexts: NULL, 
+				       nav_to? nav_to->contexts: NULL);
     departures = (Vector *) context_nav->car;
     arrivals = (Vector *) context_nav->cdr;
     objectFree((Object *) context_nav, FALSE);
@@ -401,7 +434,7 @@ doAddNavigation(
 	    xmlAddChild(parent, new);
 	    nav->node = NULL;
 	}
-	xmlAddChild(parent, nav_to->node);
+	xmlAddChild(parent, nav_to->node->node);
     }
 
     objectFree((Object *) departures, TRUE);
@@ -497,32 +530,48 @@ void
 addNavigationToDoc(xmlNode *parent_node)
 {
     Node *this;
-    Node *node_from;
-    Node *node_to = NULL;
+    NavPosition positions[2] = {{NULL, NULL, NULL, NULL}, 
+				{NULL, NULL, NULL, NULL}};
+    NavPosition *nav_from = NULL;
+    NavPosition *nav_to = NULL;
     int i;
-    Vector *nodes;
-    Hash *byfqn;
+    Vector *volatile nodes;
+    Hash *volatile byfqn = NULL;
 
     nodes = vectorFromDoc(parent_node);
-    byfqn = makeNodesHash(nodes);
-    EACH(nodes, i) {
-	this = (Node *) ELEM(nodes, i);
+    BEGIN {
+	byfqn = makeNodesHash(nodes);
+	EACH(nodes, i) {
+	    this = (Node *) ELEM(nodes, i);
 	
-	if (!nodeIsDisabled(this->node)) {
-	    /* If this node is disabled, there is no work to be done for
-	     * it, so no point in adding any navigation. */
-	    node_from = node_to;
-	    node_to = this;
-
-	    doAddNavigation(parent_node, node_from, node_to);
+	    if (!nodeIsDisabled(this->node)) {
+		/* If this node is disabled, there is no work to be done
+		 * for it, so no point in adding any navigation.  The
+		 * position we navigated to becomes the one we navigate
+		 * from, and the older position is re-used for the next
+		 * node. */
+		nav_from = nav_to;
+		nav_to = (nav_from == &positions[0])? &positions[1]: 
+		                                     &positions[0];
+		setNavPosition(nav_to, this, byfqn);
+
+		doAddNavigation(parent_node, nav_from, nav_to);
+	    }
 	}
-    }
 	
-    if (node_to) {
-	doAddNavigation(parent_node, node_to, NULL);
+	if (nav_to) {
+	    doAddNavigation(parent_node, nav_to, NULL);
+	}
     }
-    //dNode(parent_node);
-    objectFree((Object *) nodes, TRUE);
-    objectFree((Object *) byfqn, FALSE);
+    EXCEPTION(ex);
+    FINALLY {
+	//dNode(parent_node);
+	for (i = 0; i < 2; i++) {
+	    clearNavPosition(&positions[i]);
+	    objectFree((Object *) positions[i].ancestry, FALSE);
+	}
+	objectFree((Object *) nodes, TRUE);
+	objectFree((Object *) byfqn, FALSE);
+    }
+    END;
 }
-
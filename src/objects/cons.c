@@ -29,7 +29,7 @@ isCons(Cons *obj)
 Cons *
 consNew(Object *car, Object *cdr)
 {
-    Cons *cons = (Cons *) skalloc(sizeof(Cons));
+    Cons *cons = (Cons *) skallocSmall(sizeof(Cons));
 
     cons->type = OBJ_CONS;
     cons->car = car;
@@ -47,7 +47,7 @@ consFree(Cons *cons, boolean free_contents)
 	objectFree(cons->car, free_contents);
 	objectFree(cons->cdr, free_contents);
     }
-    skfree((void *) cons);
+    skfreeSmall((void *) cons, sizeof(Cons));
 }
 
 /* Using a list as a stack, push an object onto the head. */
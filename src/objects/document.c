@@ -13,6 +13,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 #include <libxml/xinclude.h>
 #include "../skit.h"
 #include "../exceptions.h"
@@ -570,7 +573,8 @@ process_possible_option(Document *doc)
 /* Loads an xml document from a file, recording any options present in
  * the Document's options field.  Note that the document is not
  * complete: a call must be made to finishDocument to cause all include
- * directives to be processed.
+ * directives to be processed.  Binary dumps, which have no options and
+ * no includes, are loaded directly and are complete.
  */
 Document *
 docFromFile(String *path)
@@ -581,6 +585,10 @@ docFromFile(String *path)
     int option_node_depth = 0;
     xmlTextReaderPtr reader;
 
+    if (isBinaryDump(path)) {
+	return binaryDumpRead(path);
+    }
+
     state = EXPECTING_OPTIONS;
     BEGIN {
 	setup_input_readers();
@@ -803,16 +811,66 @@ documentPrint(FILE *fp, Document *doc)
     printPrintable(fp, node);
 }
 
-void
-documentPrintXML(FILE *fp, Document *doc)
+/* gzwrite returns 0 on error, whereas libxml2 expects -1.
+ */
+static int
+gzipWrite(void *context, const char *buffer, int len)
 {
-    xmlChar *xmlbuf;
-    int buffersize;
+    int written;
+
+    if (len == 0) {
+	return 0;
+    }
+    written = gzwrite((gzFile) context, buffer, (unsigned) len);
+    return (written > 0)? written: -1;
+}
+
+static int
+gzipClose(void *context)
+{
+    return (gzclose((gzFile) context) == Z_OK)? 0: -1;
+}
+
+/* Create an xmlOutputBuffer that writes to fp, optionally through a
+ * gzip compressor.  The compressor writes to a duplicate of fp's file
+ * descriptor so that closing the buffer does not close fp.
+ */
+static xmlOutputBuffer *
+outputBufferForFile(FILE *fp, boolean compress)
+{
+    gzFile gz;
+    int fd;
 
+    if (!compress) {
+	return xmlOutputBufferCreateFile(fp, NULL);
+    }
+
+    fflush(fp);
+    if ((fd = dup(fileno(fp))) < 0) {
+	RAISE(GENERAL_ERROR, 
+	      newstr("Cannot open compressed output stream"));
+    }
+    if (!(gz = gzdopen(fd, "wb"))) {
+	close(fd);
+	RAISE(GENERAL_ERROR, 
+	      newstr("Cannot open compressed output stream"));
+    }
+    return xmlOutputBufferCreateIO(gzipWrite, gzipClose, (void *) gz, NULL);
+}
+
+/* Write the formatted XML for doc to fp, gzip-compressed if compress
+ * is set.  The output is written through an xmlOutputBuffer as it is
+ * generated, rather than being built in memory first, so that the
+ * memory cost of printing a large document is independent of its
+ * size, and so that anything reading from fp sees output immediately.
+ * Closing the output buffer flushes, but does not close, fp.
+ */
+void
+documentPrintXML(FILE *fp, Document *doc, boolean compress)
+{
     if (doc->doc) {
-	xmlDocDumpFormatMemory(doc->doc, &xmlbuf, &buffersize, 1);
-	fputs((char *) xmlbuf, fp);
-	xmlFree(xmlbuf);
+	(void) xmlSaveFormatFileTo(outputBufferForFile(fp, compress), 
+				   doc->doc, NULL, 1);
     }
 }
 
@@ -895,11 +953,10 @@ recordCurDocumentSkippedLines(String *URI, int lines)
     recordDocumentSkippedLines(cur_document, URI, lines);
 }
 
-Document *
-findDoc(String *filename)
+static String *
+findDocPath(String *filename)
 {
     String *doc_path = findFile(filename);
-    Document *doc;
     if (!doc_path) {
 	Vector *roots = (Vector *) symbolGetValue("template-paths");
 	Object *ver = symbolGetValue("dbver");
@@ -908,8 +965,13 @@ findDoc(String *filename)
 	RAISE(FILEPATH_ERROR, 
 	      newstr("findDoc: cannot find \"%s\"", filename->value));
     }
-    doc = docFromFile(doc_path);
-    objectFree((Object *) doc_path, TRUE);
+    return doc_path;
+}
+
+static Document *
+docFromPath(String *filename, String *doc_path)
+{
+    Document *doc = docFromFile(doc_path);
     if (!doc) {
 	RAISE(FILEPATH_ERROR, 
 	      newstr("findDoc: failed to open \"%s\"", filename->value));
@@ -918,6 +980,116 @@ findDoc(String *filename)
     return doc;
 }
 
+Document *
+findDoc(String *filename)
+{
+    String *volatile doc_path = findDocPath(filename);
+    Document *doc = NULL;
+
+    BEGIN {
+	doc = docFromPath(filename, doc_path);
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree((Object *) doc_path, TRUE);
+    }
+    END;
+    return doc;
+}
+
+/* Stylesheets, once loaded, are kept for the life of the process so
+ * that repeated transforms with the same stylesheet, whether within a
+ * single action or across a sequence of actions, parse and compile it
+ * only once.  Entries are keyed by the stylesheet name along with the
+ * dbtype and db version which are used to resolve it to a file, and
+ * are of the form: (path mtime . document).  Before an entry is
+ * re-used, the modification time of its file is checked, and if the
+ * file has changed it is re-read.  Replaced entries are retained until
+ * documentFreeMem() is called, as callers may still be using them.
+ */
+static Hash *stylesheet_cache = NULL;
+static Cons *stale_stylesheets = NULL;
+
+static String *
+stylesheetCacheKey(String *filename)
+{
+    Object *dbtype = symbolGetValue("dbtype");
+    Object *ver = symbolGetValue("dbver");
+    char *dbtype_str;
+    char *ver_str;
+    char *key;
+
+    if (!ver) {
+	ver = symbolGetValue("dbver-from-source");
+    }
+    dbtype_str = objectSexp(dbtype);
+    ver_str = objectSexp(ver);
+    key = newstr("%s:%s:%s", filename->value, dbtype_str, ver_str);
+    skfree(dbtype_str);
+    skfree(ver_str);
+    return stringNewByRef(key);
+}
+
+static int
+fileMtime(String *path)
+{
+    struct stat statbuf;
+
+    if (stat(path->value, &statbuf) == 0) {
+	return (int) statbuf.st_mtime;
+    }
+    return -1;
+}
+
+/* Return the Document for the named xsl stylesheet, from the
+ * stylesheet cache if possible.  The returned Document belongs to the
+ * cache and must not be freed by the caller.
+ */
+Document *
+findStylesheet(String *filename)
+{
+    String *volatile key = stylesheetCacheKey(filename);
+    String *volatile doc_path = NULL;
+    Cons *entry;
+    Cons *prev;
+    Document *doc = NULL;
+    int mtime;
+
+    BEGIN {
+	if (!stylesheet_cache) {
+	    stylesheet_cache = hashNew(TRUE);
+	}
+	if (entry = (Cons *) hashGet(stylesheet_cache, (Object *) key)) {
+	    mtime = fileMtime((String *) entry->car);
+	    if (mtime == ((Int4 *) ((Cons *) entry->cdr)->car)->value) {
+		doc = (Document *) ((Cons *) entry->cdr)->cdr;
+	    }
+	}
+	if (!doc) {
+	    doc_path = findDocPath(filename);
+	    mtime = fileMtime(doc_path);
+	    doc = docFromPath(filename, doc_path);
+	    entry = consNew((Object *) doc_path, 
+			    (Object *) consNew((Object *) int4New(mtime), 
+					       (Object *) doc));
+	    doc_path = NULL;
+	    if (prev = (Cons *) hashAdd(stylesheet_cache, 
+					(Object *) key, (Object *) entry)) {
+		stale_stylesheets = consNew((Object *) prev, 
+					    (Object *) stale_stylesheets);
+	    }
+	    key = NULL;
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree((Object *) key, TRUE);
+	objectFree((Object *) doc_path, TRUE);
+    }
+    END;
+    return doc;
+}
+
 boolean 
 docIsPrintable(Document *doc)
 {
@@ -1254,6 +1426,11 @@ documentFreeMem()
     prev_path = NULL;
     prev_templatename = NULL;
     scatter_template = NULL;
+
+    objectFree((Object *) stylesheet_cache, TRUE);
+    objectFree((Object *) stale_stylesheets, TRUE);
+    stylesheet_cache = NULL;
+    stale_stylesheets = NULL;
 }
 
 xmlNode *
@@ -11,6 +11,8 @@
  * Provides functions for manipulating hash cells.  The hash keys are always
  * standard C strings created from the key object.  The hash contents
  * are stored internally as a cons of (key_object . contents_object).
+ * For lookups, the key strings for String and Int4 keys are built in
+ * a local buffer so that no memory needs to be allocated.
  */
 
 #include <stdio.h>
@@ -20,6 +22,7 @@
 #include "../exceptions.h"
 
 #define DEBUG_HASH 0
+#define KEYBUF_SIZE 256
 
 /* TODO: ADD TESTS FOR hash->hash existence throughout, and raise an
  *  appropriate exception if it is missing.  The text should say
@@ -71,6 +74,43 @@ hashNew(boolean use_skalloc)
     return hash;
 }
 
+/* Return the hash key string for key.  This is the same as
+ * objectSexp(key) but, where possible, is written into buf rather than
+ * being allocated.  If the result is not buf, it must be freed by the
+ * caller using freeKeyStr. */
+static char *
+keyStr(Object *key, char *buf)
+{
+    size_t len;
+
+    key = dereference(key);
+    if (key) {
+	if (key->type == OBJ_STRING) {
+	    len = strlen(((String *) key)->value);
+	    if (len + 3 <= KEYBUF_SIZE) {
+		buf[0] = '\'';
+		memcpy(buf + 1, ((String *) key)->value, len);
+		buf[len + 1] = '\'';
+		buf[len + 2] = '\0';
+		return buf;
+	    }
+	}
+	else if (key->type == OBJ_INT4) {
+	    sprintf(buf, "%d", ((Int4 *) key)->value);
+	    return buf;
+	}
+    }
+    return objectSexp(key);
+}
+
+static void
+freeKeyStr(char *keystr, char *buf)
+{
+    if (keystr != buf) {
+	skfree(keystr);
+    }
+}
+
 /* Get the contents that match key from the hash.  This returns the
  * stored contents which is an alist entry where the car is the key and
  * the cdr, the real contents.  */
@@ -94,6 +134,7 @@ hashAdd(Hash *hash_in, Object *key, Object *contents)
      * the key.  The contents will be a Cons-cell containing the real
      * key object and the real contents. */
     Hash *hash;
+    char buf[KEYBUF_SIZE];
     char *keystr;
     Cons *cons;
     Object *previous_contents = NULL;
@@ -112,7 +153,7 @@ hashAdd(Hash *hash_in, Object *key, Object *contents)
     if (contents) {
 	assert(isObject(contents), "hashAdd: contents is not an object");
     }
-    keystr = objectSexp(key);
+    keystr = keyStr(key, buf);
 
     already_exists = g_hash_table_lookup_extended(
 	(GHashTable *) hash->hash, (gpointer) keystr,
@@ -146,7 +187,13 @@ hashAdd(Hash *hash_in, Object *key, Object *contents)
 	previous_contents = cons->cdr;
 	objectFree((Object *) cons->car, TRUE);
 	objectFree((Object *) cons, FALSE);
-	skfree((void *) previous_key);
+
+	/* Re-use the existing key string. */
+	freeKeyStr(keystr, buf);
+	keystr = previous_key;
+    }
+    else if (keystr == buf) {
+	keystr = newstr("%s", buf);
     }
     cons = consNew(key, contents);
 
@@ -243,6 +290,7 @@ toHash(Cons *cons)
 Object *
 hashGet(Hash *hashref, Object *key)
 {
+    char buf[KEYBUF_SIZE];
     char *strkey;
     Cons *contents;
     Hash *hash;
@@ -253,9 +301,9 @@ hashGet(Hash *hashref, Object *key)
 	hash = hashref;
     }
 
-    strkey = objectSexp(key);
+    strkey = keyStr(key, buf);
     contents = (Cons *) hashLookup(hash, strkey);
-    skfree(strkey);
+    freeKeyStr(strkey, buf);
     if (contents) {
 	assert(contents->type == OBJ_CONS,
 	       "hashGet: Expected contents to be Cons");
@@ -270,6 +318,7 @@ hashGet(Hash *hashref, Object *key)
 Object *
 hashDel(Hash *hash, Object *key)
 {
+    char buf[KEYBUF_SIZE];
     char *strkey;
     Cons *contents;
     Object *result = NULL;
@@ -277,7 +326,7 @@ hashDel(Hash *hash, Object *key)
     gpointer value;
     boolean found;
 
-    strkey = objectSexp(key);
+    strkey = keyStr(key, buf);
     found = g_hash_table_lookup_extended((GHashTable *) hash->hash,
 					 (gconstpointer) strkey,
 					 &orig_key, &value);
@@ -290,13 +339,14 @@ hashDel(Hash *hash, Object *key)
 	objectFree((Object *) contents, TRUE);
 	if (!g_hash_table_steal((GHashTable *) hash->hash, 
 				 (gconstpointer) strkey)) {
-	    RAISE(GENERAL_ERROR, 
-		  newstr("hashDel: failed to remove hash item \"%s\"\n",
-			 strkey));
+	    char *msg = newstr("hashDel: failed to remove hash item \"%s\"\n",
+			       strkey);
+	    freeKeyStr(strkey, buf);
+	    RAISE(GENERAL_ERROR, msg);
 	}
 	skfree(orig_key);
     }
-    skfree(strkey);
+    freeKeyStr(strkey, buf);
     return result;
 }
 
@@ -135,7 +135,7 @@ isObject(Object *obj)
 Int4 *
 int4New(int value)
 {
-    Int4 *obj = (Int4 *) skalloc(sizeof(Int4));
+    Int4 *obj = (Int4 *) skallocSmall(sizeof(Int4));
     obj->type = OBJ_INT4;
     obj->value = value;
     return obj;
@@ -152,7 +152,7 @@ int4Dup(Int4 *in)
 static void
 int4Free(Int4 *obj)
 {
-    skfree((void *) obj);
+    skfreeSmall((void *) obj, sizeof(Int4));
 }
 
 /* Compare two objects that appear to be integers using strcmp
@@ -225,7 +225,8 @@ fnRefFree(FnReference *ref)
 ObjReference *
 objRefNew(Object *obj)
 {
-    ObjReference *result = (ObjReference *) skalloc(sizeof(ObjReference));
+    ObjReference *result = 
+	(ObjReference *) skallocSmall(sizeof(ObjReference));
     result->type = OBJ_OBJ_REFERENCE;
     
     if (obj && (obj->type == OBJ_OBJ_REFERENCE)) {
@@ -240,7 +241,7 @@ objRefNew(Object *obj)
 static void
 objRefFree(ObjReference *ref)
 {
-    skfree(ref);
+    skfreeSmall(ref, sizeof(ObjReference));
 }
 
 
@@ -447,26 +448,66 @@ contextNew(String *context_type, String *value, String *dflt)
 static DagNode *
 basicDagNode()
 {
-    DagNode *new = skalloc(sizeof(DagNode));
+    DagNode *new = skallocArena(sizeof(DagNode));
     new->type = OBJ_DAGNODE;
     new->fqn = NULL;
+    new->pqn = NULL;
+    new->parent_fqn = NULL;
+    new->follow = NULL;
+    new->cycle_breaker = NULL;
     new->dbobject = NULL;
     new->build_type = UNSPECIFIED_NODE;
     new->status = UNVISITED;
     new->deps = NULL;
+    new->scc_index = 0;
     
     return new;
 }
 
+/* Decode, in a single pass over its attributes, those attributes of a
+ * dbobject node that the dependency resolver needs.
+ */
+static void
+decodeDagNodeAttributes(DagNode *dagnode, xmlNode *node)
+{
+    xmlAttr *attr;
+    String **p_field;
+    xmlChar *value;
+
+    for (attr = node->properties; attr; attr = attr->next) {
+	if (streq((char *) attr->name, "fqn")) {
+	    p_field = &dagnode->fqn;
+	}
+	else if (streq((char *) attr->name, "pqn")) {
+	    p_field = &dagnode->pqn;
+	}
+	else if (streq((char *) attr->name, "parent")) {
+	    p_field = &dagnode->parent_fqn;
+	}
+	else if (streq((char *) attr->name, "follow")) {
+	    p_field = &dagnode->follow;
+	}
+	else if (streq((char *) attr->name, "cycle_breaker")) {
+	    p_field = &dagnode->cycle_breaker;
+	}
+	else {
+	    continue;
+	}
+	if ((!*p_field) &&
+	    (value = xmlNodeListGetString(node->doc, attr->children, 1))) {
+	    *p_field = stringNew((char *) value);
+	    xmlFree(value);
+	}
+    }
+}
+
 DagNode *
 dagNodeNew(xmlNode *node, DagNodeBuildType build_type)
 {
     DagNode *new = basicDagNode();
-    String *fqn;
 
     assert(node, "dagnodeNew: node not provided");
-    fqn = nodeAttribute(node, "fqn");
-    new->fqn = fqn;
+    decodeDagNodeAttributes(new, node);
     new->dbobject = node;
     new->status = UNVISITED;
     new->build_type = build_type;
@@ -482,7 +523,7 @@ dagNodeNew(xmlNode *node, DagNodeBuildType build_type)
 DependencySet *
 dependencySetNew(DagNode *definition_node)
 {
-    DependencySet *new = skalloc(sizeof(DependencySet));
+    DependencySet *new = skallocArena(sizeof(DependencySet));
     static int id = 1;
     new->type = OBJ_DEPENDENCYSET;
     new->id = id++;
@@ -503,7 +544,7 @@ dependencySetNew(DagNode *definition_node)
 Dependency *
 dependencyNew(String *qn, boolean qn_is_full, boolean is_forwards)
 {
-    Dependency *new = skalloc(sizeof(Dependency));
+    Dependency *new = skallocArena(sizeof(Dependency));
     static int id = 1;
     new->type = OBJ_DEPENDENCY;
     new->id = id++;
@@ -524,8 +565,12 @@ static void
 dagNodeFree(DagNode *node)
 {
     objectFree((Object *) node->fqn, TRUE);
+    objectFree((Object *) node->pqn, TRUE);
+    objectFree((Object *) node->parent_fqn, TRUE);
+    objectFree((Object *) node->follow, TRUE);
+    objectFree((Object *) node->cycle_breaker, TRUE);
     objectFree((Object *) node->deps, FALSE);
-    skfree(node);
+    skfreeSmall(node, sizeof(DagNode));
 }
 
 static void
@@ -548,7 +593,7 @@ dependencySetFree(DependencySet *depset, boolean free_contents)
 	objectFree((Object *) depset->fallback_parent, TRUE);
 	objectFree((Object *) depset->condition, TRUE);
     }
-    skfree(depset);
+    skfreeSmall(depset, sizeof(DependencySet));
 }
 
 static void
@@ -558,7 +603,7 @@ dependencyFree(Dependency *dep, boolean free_contents)
 	objectFree((Object *) dep->qn, TRUE);
 	objectFree((Object *) dep->condition, TRUE);
     }
-    skfree((Object *) dep);
+    skfreeSmall(dep, sizeof(Dependency));
 }
 
 /* Free a dynamically allocated object. */
@@ -963,6 +1008,102 @@ evalSexp(char *str)
     return result;
 }
 
+/* Identify whether an expression read by objectRead can be copied by
+ * compiledCopy. */
+static boolean
+isCompilable(Object *obj)
+{
+    if (!obj) {
+	return TRUE;
+    }
+    switch (obj->type) {
+    case OBJ_CONS:
+	return isCompilable(((Cons *) obj)->car) &&
+	    isCompilable(((Cons *) obj)->cdr);
+    case OBJ_SYMBOL:
+    case OBJ_INT4:
+    case OBJ_STRING:
+    case OBJ_REGEXP:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+/* Copy a compiled expression so that it may be evaluated.  Builtin
+ * functions modify their argument lists, so each evaluation needs its
+ * own copy of the list structure.  Symbols belong to the symbol table
+ * and are shared rather than copied. */
+static Object *
+compiledCopy(Object *obj)
+{
+    Object *volatile car;
+
+    if (!obj) {
+	return NULL;
+    }
+    switch (obj->type) {
+    case OBJ_CONS:
+	car = compiledCopy(((Cons *) obj)->car);
+	BEGIN {
+	    obj = (Object *) consNew(car,
+				     compiledCopy(((Cons *) obj)->cdr));
+	}
+	EXCEPTION(ex) {
+	    objectFree(car, TRUE);
+	}
+	END;
+	return obj;
+    case OBJ_SYMBOL:
+	return obj;
+    default:
+	return objectCopy(obj);
+    }
+}
+
+/* Read a string expression so that it can be repeatedly evaluated,
+ * using evalCompiled, without having to be re-read.  Returns FALSE if
+ * the expression cannot be handled this way, in which case evalSexp
+ * must be used instead. */
+boolean
+compileSexp(char *str, Object **p_expr)
+{
+    Object *obj;
+    TokenStr token_str = {str, '\0', NULL};
+
+    obj = trappedObjectRead(&token_str);
+    if (isCompilable(obj)) {
+	*p_expr = obj;
+	return TRUE;
+    }
+    objectFree(obj, TRUE);
+    *p_expr = NULL;
+    return FALSE;
+}
+
+/* Evaluate an expression returned from compileSexp.  The expression
+ * itself is not modified. */
+Object *
+evalCompiled(Object *expr)
+{
+    Object *volatile obj;
+    Object *result = NULL;
+
+    if (obj = compiledCopy(expr)) {
+	BEGIN {
+	    result = trappedObjectEval(obj);
+	}
+	EXCEPTION(ex);
+	FINALLY {
+	    if (result != obj) {
+		objectFree(obj, TRUE);
+	    }
+	}
+	END;
+    }
+    return result;
+}
+
 /* Print a string expression from object to the specified stream, and
  * starting with the specified prefix.  This is for debugging. */
 void
@@ -987,8 +1128,8 @@ objSelect(Object *collection, Object *key)
     case OBJ_HASH: result = hashGet((Hash *) collection, key); break;
     case OBJ_CONS: result = consGet((Cons *) collection, key); break;
     case OBJ_VECTOR: result = vectorGet((Vector *) collection, key); break;
-    case OBJ_TUPLE: return (Object *) tupleGet((Tuple *) collection, key);
-    case OBJ_CURSOR: return (Object *) cursorGet((Cursor *) collection, key);
+    case OBJ_TUPLE: return tupleGet((Tuple *) collection, key);
+    case OBJ_CURSOR: return cursorSelect((Cursor *) collection, key);
     default: 
 	RAISE(NOT_IMPLEMENTED_ERROR, 
 	      newstr("objSelect: no method for selecting from %s",
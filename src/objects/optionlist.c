@@ -230,7 +230,7 @@ addAbbrevs(Cons *optionlist, String *newkey, Cons *abbrevs)
 	else {
 	    objectFree((Object *) alias, TRUE);
 	}
-	skfree(list);
+	objectFree((Object *) list, FALSE);
 	list = next;
     }
     return;
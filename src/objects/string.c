@@ -30,7 +30,7 @@ appendStr(String *str1, String *str2)
 String *
 stringNewByRef(char *value)
 {
-    String *obj = (String *) skalloc(sizeof(String));
+    String *obj = (String *) skallocSmall(sizeof(String));
     obj->type = OBJ_STRING;
     obj->value = value;
     return obj;
@@ -59,7 +59,7 @@ stringFree(String *obj, boolean free_contents)
     if (free_contents) {
 	skfree((void *) obj->value);
     }
-    skfree((void *) obj);
+    skfreeSmall((void *) obj, sizeof(String));
 }
 
 String *
@@ -19,37 +19,93 @@
 #include "../exceptions.h"
 
 static Hash *symbols = NULL;
-static Cons *symbol_scope = NULL;
+
+/* Symbol scopes are kept in a flat stack of ScopeEntry records rather
+ * than as lists of cons cells.  Each entry saves the value that a
+ * symbol had before it was redefined in a new scope.  scope_frames
+ * records, for each active scope, the index of its first entry in
+ * scope_entries.  The scope field of a symbol is 1 + the index of its
+ * most recent entry, or 0 if the symbol has never been redefined
+ * within a scope; the entries for a given symbol are chained through
+ * their prev fields.
+ */
+typedef struct ScopeEntry {
+    Symbol *sym;
+    Object *saved;
+    int     level;
+    int     prev;
+} ScopeEntry;
+
+#define SCOPE_STACK_INCR 64
+
+static ScopeEntry *scope_entries = NULL;
+static int scope_entries_size = 0;
+static int scope_entries_used = 0;
+static int *scope_frames = NULL;
+static int scope_frames_size = 0;
+static int scope_level = 0;
+
+static void *
+growStack(void *stack, int *p_size, size_t elem_size)
+{
+    *p_size += SCOPE_STACK_INCR;
+    if (stack) {
+	return skrealloc(stack, *p_size * elem_size);
+    }
+    return skalloc(*p_size * elem_size);
+}
+
+/* Release the scope stacks once the outermost scope has been dropped.
+ */
+static void
+freeScopeStacks()
+{
+    if (scope_entries) {
+	skfree(scope_entries);
+	scope_entries = NULL;
+	scope_entries_size = 0;
+    }
+    if (scope_frames) {
+	skfree(scope_frames);
+	scope_frames = NULL;
+	scope_frames_size = 0;
+    }
+}
 
 //TODO: Make setsym save the current contents of a symbol instead of
 //freeing it, and have dropScopeForSymbol do the actual freeing.
 
 static void
-dropScopeForSymbol(Symbol *sym)
+dropScopeForSymbol(ScopeEntry *entry)
 {
-    Cons *prev = (Cons *) consPop(&(sym->scope));
+    Symbol *sym = entry->sym;
     //printSexp(stderr, "connect: ", symbolGetValue("connect"));
     //printSexp(stderr, "DROPPING SCOPE FOR SYM: ", sym);
-    if (!prev) {
+    if (!sym->scope) {
 	RAISE(LIST_ERROR, 
 	      newstr("Symbol %s has no past scope", sym->name));
     }
-    // TODO: Assert that prev is a cons
-    if (prev->cdr != (Object *) symbol_scope) {
+    if (&scope_entries[sym->scope - 1] != entry) {
 	RAISE(LIST_ERROR, 
 	      newstr("Symbol %s is not defined in this scope", sym->name));
     }
     objectFree(sym->svalue, TRUE);
-    sym->svalue = prev->car;
-    objectFree((Object *) prev, FALSE);
+    sym->svalue = entry->saved;
+    sym->scope = entry->prev;
+}
+
+static boolean
+inCurrentScope(Symbol *sym)
+{
+    return sym->scope && 
+	(scope_entries[sym->scope - 1].level == scope_level);
 }
 
 void
 setScopeForSymbol(Symbol *sym)
 {
-    Cons *prev;
-    Cons *cur_scope;
-    if (!symbol_scope) {
+    ScopeEntry *entry;
+    if (!scope_level) {
 	/* There is nothing to do if we have not defined a symbol scope
 	 * yet. */
 	return;
@@ -57,46 +113,53 @@ setScopeForSymbol(Symbol *sym)
 
     //printSexp(stderr, "connect: ", symbolGetValue("connect"));
     //printSexp(stderr, "SETTING SCOPE FOR SYM: ", sym);
-    if (sym->scope) {
-	/* Check whether this symbol has already been defined in the
-	 * current scope.  If so, there is nothing to be done. */
-	cur_scope = (Cons *) sym->scope->car;
-	if (cur_scope->cdr == (Object *) symbol_scope) {
-	    return;
-	}
+    if (inCurrentScope(sym)) {
+	/* This symbol has already been defined in the current
+	 * scope, so there is nothing to be done. */
+	return;
     }
-    prev = consNew(sym->svalue, (Object *) symbol_scope);
-    (void) consPush(&(sym->scope), (Object *) prev);
-    sym->svalue = NULL;
-
-    if (symbol_scope) {
-	consPush((Cons **) &(symbol_scope->car), (Object *) sym);
+    if (scope_entries_used >= scope_entries_size) {
+	scope_entries = (ScopeEntry *) growStack(scope_entries, 
+						 &scope_entries_size,
+						 sizeof(ScopeEntry));
     }
+    entry = &scope_entries[scope_entries_used++];
+    entry->sym = sym;
+    entry->saved = sym->svalue;
+    entry->level = scope_level;
+    entry->prev = sym->scope;
+    sym->scope = scope_entries_used;
+    sym->svalue = NULL;
 }
 
 void
 newSymbolScope()
 {
     //fprintf(stderr, "NEW SCOPE\n");
-    (void) consPush(&symbol_scope, NULL);
+    if (scope_level >= scope_frames_size) {
+	scope_frames = (int *) growStack(scope_frames, &scope_frames_size,
+					 sizeof(int));
+    }
+    scope_frames[scope_level++] = scope_entries_used;
 }
 
 void
 dropSymbolScope()
 {
-    Cons *symbol_list;
-    Symbol *sym;
+    int first;
 
-    symbol_list = symbol_scope? (Cons *) symbol_scope->car: NULL;
+    if (!scope_level) {
+	return;
+    }
+    first = scope_frames[scope_level - 1];
 
-    //printSexp(stderr, "DROPPING SCOPE FOR ", symbol_list);
-    while (symbol_list) {
-	// TODO: Assert that symbol_list is a cons
-	sym = (Symbol *) consPop(&symbol_list);
-	// TODO: Assert that symbol is a symbol
-	dropScopeForSymbol(sym);
+    //fprintf(stderr, "DROPPING SCOPE %d\n", scope_level);
+    while (scope_entries_used > first) {
+	dropScopeForSymbol(&scope_entries[--scope_entries_used]);
+    }
+    if (!--scope_level) {
+	freeScopeStacks();
     }
-    (void) consPop(&symbol_scope);
 }
 
 
@@ -114,6 +177,10 @@ void
 freeSymbolTable()
 {
     Hash *hash = symbols;
+
+    while (scope_level) {
+	dropSymbolScope();
+    }
     symbols = NULL;
     if (hash) {
 	hashFree(hash, TRUE);
@@ -136,7 +203,7 @@ symbolNew(char *name)
 	sym->name = newstr("%s", name);
 	sym->fn = NULL;
 	sym->svalue = NULL;
-	sym->scope = NULL;
+	sym->scope = 0;
 	(void) hashAdd(symbols, (Object *) hashkey, (Object *) sym);
 	setScopeForSymbol(sym);
 	// TODO: See if we can move setscope out of this conditional
@@ -162,14 +229,13 @@ void
 symbolSet(char *name, Object *value)
 {
     Hash *symbols = symbolTable();
-    String *hashkey = stringNew(name);
-    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) hashkey);
+    String hashkey = {OBJ_STRING, name};
+    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) &hashkey);
 
     if (!sym) {
 	RAISE(GENERAL_ERROR,
 	      newstr("Error in symbolSet - no such symbol: %s", name));
     }
-    stringFree(hashkey, TRUE);
     symSet(sym, value);
 }
 
@@ -179,17 +245,15 @@ void
 symbolSetRoot(char *name, Object *value)
 {
     Hash *symbols = symbolTable();
-    String *hashkey = stringNew(name);
-    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) hashkey);
+    String hashkey = {OBJ_STRING, name};
+    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) &hashkey);
     Object **valptr;
     if (sym->scope) {
-	Cons *scope_node = sym->scope;
-	Cons *value_node;
-	while (scope_node->cdr) {
-	    scope_node = (Cons *) scope_node->cdr;
+	ScopeEntry *entry = &scope_entries[sym->scope - 1];
+	while (entry->prev) {
+	    entry = &scope_entries[entry->prev - 1];
 	}
-	value_node = (Cons *) scope_node->car;
-	valptr = &(value_node->car);
+	valptr = &(entry->saved);
     }
     else {
 	valptr = &(sym->svalue);
@@ -199,7 +263,6 @@ symbolSetRoot(char *name, Object *value)
 	objectFree(*valptr, TRUE);
     }
     
-    stringFree(hashkey, TRUE);
     *valptr = value;
 }
 
@@ -207,10 +270,9 @@ Symbol *
 symbolGet(char *name)
 {
     Hash *symbols = symbolTable();
-    String *hashkey = stringNew(name);
-    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) hashkey);
+    String hashkey = {OBJ_STRING, name};
+    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) &hashkey);
     
-    stringFree(hashkey, TRUE);
     return sym;
 }
 
@@ -229,10 +291,9 @@ Object *
 symbolGetValue(char *name)
 {
     Hash *symbols = symbolTable();
-    String *hashkey = stringNew(name);
-    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) hashkey);
+    String hashkey = {OBJ_STRING, name};
+    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) &hashkey);
     
-    stringFree(hashkey, TRUE);
     return symGet(sym);
 }
 
@@ -240,19 +301,12 @@ Object *
 symbolGetValueWithStatus(char *name, boolean *in_local_scope)
 {
     Hash *symbols = symbolTable();
-    String *hashkey = stringNew(name);
-    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) hashkey);
-    Cons *cur_scope;
+    String hashkey = {OBJ_STRING, name};
+    Symbol *sym = (Symbol *) hashGet(symbols, (Object *) &hashkey);
 
-    stringFree(hashkey, TRUE);
     if (sym) {
-	if (sym->scope) {
-	    /* Check whether this symbol has already been defined in the
-	     * current scope.  If so, there is nothing to be done. */
-	    cur_scope = (Cons *) sym->scope->car;
-	    if (cur_scope->cdr == (Object *) symbol_scope) {
-		*in_local_scope = TRUE;
-	    }
+	if (inCurrentScope(sym)) {
+	    *in_local_scope = TRUE;
 	}
 	return dereference(sym->svalue);
     }
@@ -361,12 +415,15 @@ boolean
 checkSymbol(Symbol *sym, void *chunk)
 {
     boolean found;
+    int idx;
     if (found = checkObj(sym->svalue, chunk)) {
 	printSexp(stderr, "...within svalue of ", (Object *) sym);
     }
-    if (checkObj((Object*) sym->scope, chunk)) {
-	printSexp(stderr, "...within scope of ", (Object *) sym);
-	found = TRUE;
+    for (idx = sym->scope; idx; idx = scope_entries[idx - 1].prev) {
+	if (checkObj(scope_entries[idx - 1].saved, chunk)) {
+	    printSexp(stderr, "...within scope of ", (Object *) sym);
+	    found = TRUE;
+	}
     }
     if (checkChunk(sym, chunk)) {
 	printSexp(stderr, "...within ", (Object *) sym);
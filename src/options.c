@@ -70,6 +70,10 @@ printOptionList()
 		      stringNew("type"), (Object *) stringNew("flag"));
 	optionlistAdd(print_options, stringNew("f*ull"), 
 		      stringNew("type"), (Object *) stringNew("flag"));
+	optionlistAdd(print_options, stringNew("gz*ip"), 
+		      stringNew("type"), (Object *) stringNew("flag"));
+	optionlistAdd(print_options, stringNew("b*inary"), 
+		      stringNew("type"), (Object *) stringNew("flag"));
 	optionlistAdd(print_options, stringNew("sources"), 
 		      stringNew("value"), (Object *) int4New(1));
 	optionlistAdd(print_options, stringNew("sources"), 
@@ -43,11 +43,19 @@ read_arg()
     if (argcons) {
 	arg = (String *) argcons->car;
 	arglist = (Cons *) argcons->cdr;
-	skfree((Object *) argcons);
+	objectFree((Object *) argcons, FALSE);
     }
     return arg;
 }
 
+/* Return TRUE if there are command line arguments still to be read,
+ * ie if another action follows the current one. */
+boolean
+args_remaining()
+{
+    return arglist != NULL;
+}
+
 void
 unread_arg(String *arg, boolean is_option)
 {
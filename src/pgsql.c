@@ -121,6 +121,7 @@ pgsqlConnect(Object *sqlfuncs)
 	connection->sqlfuncs = sqlfuncs;
 	connection->dbtype = stringNew("postgres");
 	connection->conn = NULL;
+	connection->statements = NULL;
 	
 	BEGIN {
 		connection->conn = (void *) PQconnectdb(connect->value);
@@ -150,6 +151,7 @@ pgsqlCleanup(Connection *connection)
 	}
 	connection->conn = NULL;
 	objectFree((Object *) connection->dbtype, TRUE);
+	objectFree((Object *) connection->statements, TRUE);
 	skfree(connection);
 }
 
@@ -176,6 +178,94 @@ pgResultCheck(PGresult *result)
 	}
 }
 
+static Cursor *
+pgCursorNew(Connection *connection, PGresult *result, String *qry)
+{
+	Cursor *curs = (Cursor *) skalloc(sizeof(Cursor));
+	curs->type = OBJ_CURSOR;
+	curs->cursor = (void *) result;
+	curs->rows = PQntuples(result);
+	curs->cols = PQnfields(result);
+	curs->fields = NULL;
+	curs->tuple.type = OBJ_TUPLE;
+	curs->tuple.cursor = curs;
+	curs->tuple.dynamic = FALSE;
+	curs->tuple.rownum = 0;
+	curs->connection = connection;
+	curs->querystr = stringNew(qry->value);
+	curs->index = NULL;
+	curs->groups = NULL;
+	curs->base = NULL;
+	curs->rowmap = NULL;
+	curs->fieldvals = NULL;
+	return curs;
+}
+
+static Connection *
+pgConnection(Connection *connection)
+{
+	if (connection->type == OBJ_OBJ_REFERENCE) {
+		return pgConnection(
+			(Connection *) ((ObjReference *) connection)->obj);
+	}
+	return connection;
+}
+
+/* Execute querystr with bind parameters.  The first time that a given
+ * query text is executed on a connection, it is simply executed with
+ * its parameters.  If the same text is executed again, which is what
+ * happens for a runsql inside a foreach, it is prepared and thereafter
+ * executed as a prepared statement, so that the server parses and
+ * plans it only once.  Statement entries record either the number of
+ * times the text has been executed (an Int4), or the name of the
+ * prepared statement (a String).  Query texts that are only executed
+ * once are never prepared.
+ */
+static PGresult *
+pgExecBound(Connection *connection, char *querystr, 
+			int nbound, char **bound_values)
+{
+	static int stmt_count = 0;
+	PGconn *conn = pgConn(connection);
+	String key = {OBJ_STRING, querystr};
+	Object *entry;
+	String *stmt_name;
+	PGresult *result;
+
+	connection = pgConnection(connection);
+	if (!connection->statements) {
+		connection->statements = hashNew(TRUE);
+	}
+	entry = hashGet(connection->statements, (Object *) &key);
+	if (entry && (entry->type == OBJ_STRING)) {
+		return PQexecPrepared(conn, ((String *) entry)->value, nbound, 
+							  (const char * const *) bound_values, 
+							  NULL, NULL, 0);
+	}
+	if (!entry) {
+		hashAdd(connection->statements, (Object *) stringNew(querystr),
+				(Object *) int4New(1));
+		return PQexecParams(conn, querystr, nbound, NULL, 
+							(const char * const *) bound_values, 
+							NULL, NULL, 0);
+	}
+
+	/* This is the second execution of querystr, so prepare it. */
+	stmt_name = stringNewByRef(newstr("skit_stmt_%d", ++stmt_count));
+	result = PQprepare(conn, stmt_name->value, querystr, nbound, NULL);
+	if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+		objectFree((Object *) stmt_name, TRUE);
+		return result;
+	}
+	PQclear(result);
+	objectFree(hashAdd(connection->statements, 
+					   (Object *) stringNew(querystr),
+					   (Object *) stmt_name), TRUE);
+	return PQexecPrepared(conn, stmt_name->value, nbound, 
+						  (const char * const *) bound_values, 
+						  NULL, NULL, 0);
+}
+
 static Cursor *
 pgsqlExecQry(Connection *connection, 
 			 String *qry,
@@ -183,27 +273,24 @@ pgsqlExecQry(Connection *connection,
 {
 	PGconn *conn = pgConn(connection);
 	char *querystr = qry->value;
+	char **bound_values = NULL;
+	int nbound = 0;
 	PGresult *result;
 	Cursor *curs;
 	
 	if (params) {
-		querystr = applyParams(querystr, params);
+		querystr = bindParams(querystr, params, &nbound, &bound_values);
+	}
+	if (nbound) {
+		result = pgExecBound(connection, querystr, nbound, bound_values);
+		skfree(bound_values);
 	}
-	if (result = PQexec(conn, querystr)) {
+	else {
+		result = PQexec(conn, querystr);
+	}
+	if (result) {
 		pgResultCheck(result);
-		curs = (Cursor *) skalloc(sizeof(Cursor));
-		curs->type = OBJ_CURSOR;
-		curs->cursor = (void *) result;
-		curs->rows = PQntuples(result);
-		curs->cols = PQnfields(result);
-		curs->fields = NULL;
-		curs->tuple.type = OBJ_TUPLE;
-		curs->tuple.cursor = curs;
-		curs->tuple.dynamic = FALSE;
-		curs->tuple.rownum = 0;
-		curs->connection = connection;
-		curs->querystr = stringNew(qry->value);
-		curs->index = NULL;
+		curs = pgCursorNew(connection, result, qry);
 		if (params) {
 			skfree(querystr);
 		}
@@ -217,13 +304,217 @@ pgsqlExecQry(Connection *connection,
 	return NULL;
 }
 
+#ifdef LIBPQ_HAS_PIPELINING
+/* Execute a list of queries, which must have had any parameters
+ * already applied, returning a list of cursors in the same order.  The
+ * queries are sent as a single pipeline so that the whole batch costs
+ * only one round trip to the server.  If any query fails, all of the
+ * cursors are freed and an SQL_ERROR is raised.
+ */
+static Cons *
+pgsqlExecBatch(Connection *connection, Cons *queries)
+{
+	PGconn *conn = pgConn(connection);
+	Cons *results = NULL;
+	Cons *last = NULL;
+	Cons *qry;
+	Cons *elem;
+	PGresult *result;
+	ExecStatusType status;
+	char *errmsg = NULL;
+	int sent = 0;
+
+	if (!PQenterPipelineMode(conn)) {
+		RAISE(SQL_ERROR, 
+			  newstr("Unable to enter pipeline mode: %s", 
+					 PQerrorMessage(conn)));
+	}
+	for (qry = queries; qry; qry = (Cons *) qry->cdr) {
+		if (!PQsendQueryParams(conn, ((String *) qry->car)->value, 
+							   0, NULL, NULL, NULL, NULL, 0)) {
+			errmsg = newstr("Fatal postgres error: %s", 
+							PQerrorMessage(conn));
+			break;
+		}
+		sent++;
+	}
+	(void) PQpipelineSync(conn);
+
+	/* Each query yields one result, followed by NULL.  Following a
+	 * failure, the remaining queries yield PGRES_PIPELINE_ABORTED. */
+	for (qry = queries; sent--; qry = (Cons *) qry->cdr) {
+		if (!(result = PQgetResult(conn))) {
+			break;
+		}
+		status = PQresultStatus(result);
+		if ((status == PGRES_COMMAND_OK) || (status == PGRES_TUPLES_OK)) {
+			elem = consNew((Object *) pgCursorNew(connection, result,
+												  (String *) qry->car), 
+						   NULL);
+			if (last) {
+				last->cdr = (Object *) elem;
+			}
+			else {
+				results = elem;
+			}
+			last = elem;
+		}
+		else {
+			if (!errmsg) {
+				errmsg = newstr("Postgres error: %s\n%s", 
+								PQresStatus(status),
+								PQresultErrorMessage(result));
+			}
+			PQclear(result);
+		}
+		while (result = PQgetResult(conn)) {
+			PQclear(result);
+		}
+	}
+
+	/* Discard everything up to and including the sync result. */
+	while (result = PQgetResult(conn)) {
+		status = PQresultStatus(result);
+		PQclear(result);
+		if (status == PGRES_PIPELINE_SYNC) {
+			break;
+		}
+	}
+	(void) PQexitPipelineMode(conn);
+
+	if (errmsg) {
+		objectFree((Object *) results, TRUE);
+		RAISE(SQL_ERROR, errmsg);
+	}
+	return results;
+}
+#endif
+
+/* Execute a command that returns no rows. */
+static void
+pgExecCommand(PGconn *conn, char *command)
+{
+	PGresult *result = PQexec(conn, command);
+	ExecStatusType status = PQresultStatus(result);
+	char *errmsg;
+
+	if (status != PGRES_COMMAND_OK) {
+		errmsg = newstr("Postgres error: %s\n%s", PQresStatus(status),
+						PQresultErrorMessage(result));
+		PQclear(result);
+		RAISE(SQL_ERROR, errmsg);
+	}
+	PQclear(result);
+}
+
+/* Begin a repeatable read transaction and export its snapshot so that
+ * worker connections may see exactly the same data.  Snapshots can
+ * only be exported from 9.2 onwards, and not from within an existing
+ * transaction, in which case we return NULL.
+ */
+static String *
+pgsqlExportSnapshot(Connection *connection)
+{
+	PGconn *conn = pgConn(connection);
+	PGresult *result;
+	String *snapshot = NULL;
+	char *errmsg;
+
+	if ((PQserverVersion(conn) < 90200) || 
+		(PQtransactionStatus(conn) != PQTRANS_IDLE)) {
+		return NULL;
+	}
+	pgExecCommand(conn, "begin transaction isolation level repeatable read");
+	result = PQexec(conn, "select pg_export_snapshot()");
+	if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+		errmsg = newstr("Unable to export snapshot: %s", 
+						PQresultErrorMessage(result));
+		PQclear(result);
+		PQclear(PQexec(conn, "rollback"));
+		RAISE(SQL_ERROR, errmsg);
+	}
+	snapshot = stringNew(PQgetvalue(result, 0, 0));
+	PQclear(result);
+	return snapshot;
+}
+
+static void
+pgsqlImportSnapshot(Connection *connection, String *snapshot)
+{
+	PGconn *conn = pgConn(connection);
+	char *command = newstr("set transaction snapshot '%s'", 
+						   snapshot->value);
+
+	BEGIN {
+		pgExecCommand(conn, 
+					  "begin transaction isolation level repeatable read");
+		pgExecCommand(conn, command);
+	}
+	EXCEPTION(ex);
+	FINALLY {
+		skfree(command);
+	}
+	END;
+}
+
+static void
+pgsqlEndSnapshot(Connection *connection)
+{
+	PGconn *conn = pgConn(connection);
+
+	if (PQtransactionStatus(conn) != PQTRANS_IDLE) {
+		pgExecCommand(conn, "commit");
+	}
+}
+
+/* Return the row within the PGresult for the 1-based rownum of cursor.
+ * Group cursors share the result of the cursor that was grouped, so
+ * their rows must be mapped.
+ */
+static int
+pgRow(Cursor *cursor, int rownum)
+{
+	if (cursor->rowmap) {
+		return cursor->rowmap[rownum - 1];
+	}
+	return rownum - 1;
+}
+
+/* Return the String for a field of a cursor row.  Field values are
+ * created only when first needed and refer directly into the PGresult
+ * rather than being copied from it.  They belong to the cursor, so
+ * callers are given a reference.
+ */
+static String *
+pgFieldValue(Cursor *cursor, int row, int col)
+{
+	String **p_value;
+	int i;
+
+	if (cursor->base) {
+		/* Group cursor rows are rows of the grouped cursor */
+		cursor = cursor->base;
+	}
+	if (!cursor->fieldvals) {
+		cursor->fieldvals = (String **) skalloc(
+			sizeof(String *) * cursor->rows * cursor->cols);
+		for (i = cursor->rows * cursor->cols - 1; i >= 0; i--) {
+			cursor->fieldvals[i] = NULL;
+		}
+	}
+	p_value = &(cursor->fieldvals[(row * cursor->cols) + col]);
+	if (!*p_value) {
+		*p_value = stringNewByRef(PQgetvalue(cursor->cursor, row, col));
+	}
+	return *p_value;
+}
+
 static Object *
 pgsqlFieldByIdx(Tuple *tuple, int col)
 {
 	Cursor *cursor = tuple->cursor;
 	int row;
 	int  is_binary;
-	char *result;
 
 	if (!tuple->rownum) {
 		RAISE(SQL_ERROR, newstr("No tuple selected"));
@@ -234,19 +525,17 @@ pgsqlFieldByIdx(Tuple *tuple, int col)
 		RAISE(SQL_ERROR, newstr("Invalid index for tuple %d", col));
 	}
 
-	row = tuple->rownum - 1;
+	row = pgRow(cursor, tuple->rownum);
 
 	if (PQgetisnull(cursor->cursor, row, col)) {
 		return NULL;
 	}
 
-	result = PQgetvalue(cursor->cursor, row, col);
-
 	if (is_binary = PQfformat(cursor->cursor, col)) {
 		return (Object *) stringNew("SOME BINARY VALUE");
 	}
 	else {
-		return (Object *) stringNew(result);
+		return (Object *) objRefNew((Object *) pgFieldValue(cursor, row, col));
 	}
 }
 
@@ -281,8 +570,12 @@ pgsqlFieldByName(Tuple *tuple, String *name)
 	Cursor *cursor = tuple->cursor;
 	Int4 *col;
 
+	if (cursor->base) {
+		/* Group cursors use the field names of the grouped cursor */
+		cursor = cursor->base;
+	}
 	if (!cursor->fields) {
-		initTupleFields(tuple);
+		initTupleFields(&(cursor->tuple));
 	}
 
 	if (col = (Int4 *) hashGet(cursor->fields, (Object *) name)) {
@@ -346,8 +639,8 @@ cursorAllRows(Cursor *cursor)
 	char *tmp;
 	char *rowstr;
 	char *result = NULL;
-	for (row = 0; row < cursor->rows; row++) {
-		rowstr = cursorRow(cursor, row);
+	for (row = 1; row <= cursor->rows; row++) {
+		rowstr = cursorRow(cursor, pgRow(cursor, row));
 		if (tmp = result) {
 			result = newstr("%s %s", tmp, rowstr);
 			skfree(rowstr);
@@ -398,7 +691,8 @@ pgTupleStr(Tuple *tuple)
 {
 	Cursor *cursor;
 	char *name;
-	String *value;
+	Object *value;
+	String *str;
 	char *result = newstr("");
 	char *tmp;
 	int col;
@@ -407,16 +701,17 @@ pgTupleStr(Tuple *tuple)
 	cursor = tuple->cursor;
 	for (col = 0; col < cursor->cols; col++) {
 		name = PQfname(cursor->cursor, col);
-		value = (String *) pgsqlFieldByIdx(tuple, col);
+		value = pgsqlFieldByIdx(tuple, col);
 		tmp = result;
 		if (value) {
-			result = newstr("%s ('%s' . '%s')", tmp, name, value->value);
+			str = (String *) dereference(value);
+			result = newstr("%s ('%s' . '%s')", tmp, name, str->value);
 		}
 		else {
 			result = newstr("%s ('%s')", tmp, name);
 		}
 		skfree(tmp);
-		objectFree((Object *) value, TRUE);
+		objectFree(value, TRUE);
 	}
 	
 	tmp = result;
@@ -428,11 +723,29 @@ pgTupleStr(Tuple *tuple)
 static void
 pgsqlFreeCursor(Cursor *cursor)
 {
+	int i;
+
+	if (cursor->base) {
+		/* A group cursor: the result set and query string belong to
+		 * the grouped cursor. */
+		skfree((void *) cursor->rowmap);
+		skfree((void *) cursor);
+		return;
+	}
+	if (cursor->fieldvals) {
+		/* Field values refer into the PGresult so must be freed
+		 * without their contents. */
+		for (i = cursor->rows * cursor->cols - 1; i >= 0; i--) {
+			objectFree((Object *) cursor->fieldvals[i], FALSE);
+		}
+		skfree((void *) cursor->fieldvals);
+	}
 	if (cursor->cursor) {
 		PQclear(cursor->cursor);
 		cursor->cursor = NULL;
 	}
 	objectFree((Object *) cursor->index, TRUE);
+	objectFree((Object *) cursor->groups, TRUE);
 	objectFree((Object *) cursor->fields, TRUE);
 	objectFree((Object *) cursor->querystr, TRUE);
     skfree((void *) cursor);
@@ -517,6 +830,102 @@ pgsqlIndexCursor(Cursor *cursor, String *fieldname)
 		}
 	}
 }
+static Cursor *
+groupCursorNew(Cursor *cursor)
+{
+	Cursor *group = (Cursor *) skalloc(sizeof(Cursor));
+	group->type = OBJ_CURSOR;
+	group->cursor = cursor->cursor;
+	group->rows = 0;
+	group->cols = cursor->cols;
+	group->fields = NULL;
+	group->tuple.type = OBJ_TUPLE;
+	group->tuple.cursor = group;
+	group->tuple.dynamic = FALSE;
+	group->tuple.rownum = 0;
+	group->connection = cursor->connection;
+	group->querystr = cursor->querystr;
+	group->index = NULL;
+	group->groups = NULL;
+	group->base = cursor;
+	group->rowmap = NULL;
+	group->fieldvals = NULL;
+	return group;
+}
+
+/* Group the rows of cursor by the value of fieldname, creating a
+ * group cursor for each distinct value.  Rows within each group
+ * retain their order from the original cursor, so set-based queries
+ * may be iterated exactly as if they had been run separately for each
+ * key.  Rows with a null key are not grouped.
+ */
+static void
+pgsqlGroupCursor(Cursor *cursor, String *fieldname)
+{
+	Int4 *col;
+	Object *field;
+	Cursor *group;
+	Cursor **owners;
+	int row;
+
+	if (cursor->groups) {
+		objectFree((Object *) cursor->groups, TRUE);
+		cursor->groups = NULL;
+	}
+
+	if (!cursor->fields) {
+		initTupleFields(&(cursor->tuple));
+	}
+
+	col = (Int4 *) hashGet(cursor->fields, (Object *) fieldname);
+	if (!col) {
+		return;
+	}
+	cursor->groups = hashNew(TRUE);
+	if (!cursor->rows) {
+		return;
+	}
+
+	/* First pass: find the group for each row, and count the rows in
+	 * each group. */
+	owners = (Cursor **) skalloc(sizeof(Cursor *) * cursor->rows);
+	for (row = 0; row < cursor->rows; row++) {
+		owners[row] = NULL;
+		if (PQgetisnull(cursor->cursor, row, col->value)) {
+			continue;
+		}
+		field = (Object *) stringNew(
+			PQgetvalue(cursor->cursor, row, col->value));
+		if (group = (Cursor *) hashGet(cursor->groups, field)) {
+			objectFree(field, TRUE);
+		}
+		else {
+			group = groupCursorNew(cursor);
+			(void) hashAdd(cursor->groups, field, (Object *) group);
+		}
+		group->rows++;
+		owners[row] = group;
+	}
+
+	/* Second pass: record the rows of each group, using the group's
+	 * tuple rownum to track how many have been recorded so far.  */
+	for (row = 0; row < cursor->rows; row++) {
+		if (group = owners[row]) {
+			if (!group->rowmap) {
+				group->rowmap = (int *) skalloc(sizeof(int) * group->rows);
+			}
+			group->rowmap[group->tuple.rownum++] = row;
+		}
+	}
+	for (row = 0; row < cursor->rows; row++) {
+		if (group = owners[row]) {
+			group->tuple.rownum = 0;
+		}
+	}
+	skfree((void *) owners);
+	cursor->tuple.rownum = 0;
+}
+
 
 static void
 loadWordList(String *filename, Hash *hash)
@@ -647,16 +1056,25 @@ registerPGSQL()
 		OBJ_MISC,
 		&pgsqlConnect,
 		&pgsqlExecQry,
+#ifdef LIBPQ_HAS_PIPELINING
+		&pgsqlExecBatch,
+#else
+		NULL,
+#endif
 		&pgsqlNextRow,
 		&pgsqlFieldByIdx,
 		&pgsqlFieldByName,
 		&pgTupleStr,
 		&pgCursorStr,
 		&pgsqlIndexCursor,
+		&pgsqlGroupCursor,
 		&pgsqlCursorGet,
 		&pgsqlDBQuote,
 		&pgsqlFreeCursor,
-		&pgsqlCleanup
+		&pgsqlCleanup,
+		&pgsqlExportSnapshot,
+		&pgsqlImportSnapshot,
+		&pgsqlEndSnapshot
 	};
 
 	ObjReference *obj = objRefNew((Object *) &funcs);
@@ -76,6 +76,7 @@ shutdown()
 	fprintf(stderr, "There is still an exception handler in place!\n");
     if (memchunks_in_use() != 0) {
 	showChunks();
+	showPoolStats();
 	fprintf(stderr, "There are still %d memory chunks allocatedi.\n",
 		memchunks_in_use());
     }
@@ -176,7 +176,7 @@ typedef struct Symbol {
     char       *name;
     ObjectFn   *fn;
     Object     *svalue;
-    Cons       *scope;
+    int         scope;
 } Symbol;
 
 typedef struct Document {
@@ -210,6 +210,7 @@ typedef struct Connection {
     String  *dbtype;
     void    *sqlfuncs;
     void    *conn;
+    Hash    *statements;  // Prepared statement info, keyed by query text
 } Connection;
 
 typedef struct Tuple {
@@ -225,10 +226,14 @@ typedef struct Cursor {
     int      cols;
     void    *cursor;
     Hash    *index;
+    Hash    *groups;
     Hash    *fields;
     Tuple    tuple;
     String  *querystr;
     Connection *connection;
+    struct Cursor *base;   /* For group cursors, the cursor grouped */
+    int     *rowmap;       /* For group cursors, rows within base */
+    String **fieldvals;    /* Field values, created as they are needed */
 } Cursor;
 
 
@@ -290,9 +295,18 @@ typedef enum {
 } DependencyApplication;
 
 
+/* The fqn, pqn, parent, follow and cycle_breaker attributes of a
+ * DagNode's dbobject are decoded once, when the DagNode is created.
+ * They are not modified afterwards so the decoded values may be used
+ * in place of nodeAttribute() calls.  Each may be NULL. 
+ */
 typedef struct DagNode {
     ObjType             type;
     String             *fqn;
+    String             *pqn;
+    String             *parent_fqn;
+    String             *follow;
+    String             *cycle_breaker;
     xmlNode            *dbobject;  // Reference only - not to be freed from here
     DagNodeStatus       status;
     DagNodeBuildType    build_type;
@@ -300,6 +314,7 @@ typedef struct DagNode {
     Vector             *tmp_deps;
     int                 cur_dep;
     int                 resolver_depth;
+    int                 scc_index;    // Used only by sccOrder()
     boolean             is_fallback;
     struct DagNode     *parent;       // Reference only
     struct DagNode     *mirror_node;  // Reference only
@@ -462,6 +477,8 @@ extern Object *objectEval(Object *obj);
 extern Object *trappedObjectEval(Object *obj);
 extern void traceOn(boolean on);
 extern Object *evalSexp(char *str);
+extern boolean compileSexp(char *str, Object **p_expr);
+extern Object *evalCompiled(Object *expr);
 extern ObjReference *objRefNew(Object *obj);
 extern Regexp *regexpNew(char *str);
 extern int objType(Object *obj);
@@ -584,6 +601,8 @@ extern char *tokenTypeName(TokenType tt);
 extern char *strEval(char *instr);
 
 //mem.c
+typedef struct Arena Arena;
+
 #ifdef MEM_DEBUG
 
 #define MEMPRINTF printf
@@ -598,6 +617,7 @@ extern void showMalloc(int number_to_show);
 extern void trackMalloc(int number_to_show);
 extern void chunkInfo(void *chunk);
 extern void *getChunk(intptr_t chunk_id);
+extern int arenaChunksInUse(Arena *arena);
 
 #define newstr(...)  memchunks_incr(g_strdup_printf(__VA_ARGS__))
 
@@ -613,6 +633,7 @@ extern void *getChunk(intptr_t chunk_id);
 #define showMalloc(x)
 #define trackMalloc(x)
 #define chunkInfo(x)
+#define arenaChunksInUse(x) 0
 
 #define newstr(...)  g_strdup_printf(__VA_ARGS__)
 
@@ -621,6 +642,12 @@ extern void *getChunk(intptr_t chunk_id);
 extern void *skalloc(size_t size);
 extern void skfree(void *ptr);
 extern void *skrealloc(void *p, size_t size);
+extern Arena *arenaBegin(void);
+extern void arenaEnd(Arena *arena);
+extern void *skallocArena(size_t size);
+extern void *skallocSmall(size_t size);
+extern void skfreeSmall(void *ptr, size_t size);
+extern void showPoolStats(void);
 extern void skitFreeMem(void);
 
 // optionlist.c
@@ -645,6 +672,7 @@ extern String *usage_msg(String *usage_for);
 extern void show_usage(FILE *dest, String *usage_for);
 extern String *read_arg(void);
 extern void unread_arg(String *arg, boolean is_option);
+extern boolean args_remaining(void);
 extern String *nextArg(String **p_arg, boolean *p_option);
 extern String *nextAction(void);
 extern Object *validateParamValue(String *type, String *value);
@@ -652,7 +680,6 @@ extern void initTemplatePath(char *arg);
 
 
 // action.c
-extern void freeStdTemplates(void);
 extern void loadInFile(String *filename);
 extern void docStackPush(Document *doc);
 extern Document *docStackPop(void);
@@ -672,6 +699,7 @@ extern void searchdir(Hash *hash, char *path, char *pattern);
 extern char *pathToFile(Vector *roots, String *templatedir, String *dbdir, 
 			Object *version, String *filename);
 extern String *findFile(String *filename);
+extern void freeFilepathIndex(void);
 extern FILE *openFile(String *filename);
 extern String *readFile(String *filename);
 extern String *nextWord(FILE *file);
@@ -685,6 +713,8 @@ extern void delFile(char *filename);
 // xmlfile.c
 extern void parseXSLStylesheet(Document *doc);
 extern Document *applyXSLStylesheet(Document *src, Document *stylesheet);
+extern void beginOutputStream(FILE *fp);
+extern void endOutputStream(void);
 extern Document *processTemplate(Document *template);
 extern void addParamsNode(Document *doc, Object *params);
 extern void rmParamsNode(Document *doc);
@@ -703,12 +733,13 @@ extern Document *documentNew(xmlDocPtr xmldoc, xmlTextReaderPtr reader);
 extern void documentFree(Document *doc, boolean free_contents);
 extern char *documentStr(Document *doc);
 extern void documentPrint(FILE *fp, Document *doc);
-extern void documentPrintXML(FILE *fp, Document *doc);
+extern void documentPrintXML(FILE *fp, Document *doc, boolean compress);
 extern void finishDocument(Document *doc);
 extern void recordCurDocumentSource(String *URI, String *path);
 extern void recordCurDocumentSkippedLines(String *URI, int lines);
 extern Cons *getDocumentInclusion(Document *doc, String *URI);
 extern Document *findDoc(String *filename);
+extern Document *findStylesheet(String *filename);
 extern boolean docIsPrintable(Document *doc);
 extern boolean docHasDeps(Document *doc);
 extern Object *xmlTraverse(xmlNode *start, TraverserFn *traverser, 
@@ -742,18 +773,28 @@ extern void finishWithConnection(void);
 extern Connection *sqlConnect(void);
 extern Cursor *sqlExec(Connection *connection, 
 		       String *qry, Object *params);
+extern Cons *sqlExecBatch(Connection *connection, Cons *queries);
+extern String *sqlExportSnapshot(Connection *connection);
+extern void sqlImportSnapshot(Connection *connection, String *snapshot);
+extern void sqlEndSnapshot(Connection *connection);
+extern String *sqlSharedSnapshot(void);
 extern void connectionFree(Connection *connection);
 extern void cursorFree(Cursor *curs);
 extern Tuple *sqlNextRow(Cursor *cursor);
 extern char *tupleStr(Tuple *tuple);
-extern String *tupleGet(Tuple *tuple, Object *key);
+extern Object *tupleGet(Tuple *tuple, Object *key);
 extern Object *cursorNext(Cursor *cursor, Object **p_placeholder);
 extern char *cursorStr(Cursor *cursor);
 extern boolean checkDbtypeIsRegistered(String *dbtype);
 extern Tuple *cursorGet(Cursor *cursor, Object *key);
 extern void *cursorIndex(Cursor *cursor, String *fieldname);
+extern void *cursorGroup(Cursor *cursor, String *fieldname);
+extern Object *cursorSelect(Cursor *cursor, Object *key);
+extern Cursor *cursorGroupGet(Cursor *cursor, Object *key);
 extern String *sqlDBQuote(String *first, String *second);
 extern char *applyParams(char *qrystr, Object *params);
+extern char *bindParams(char *qrystr, Object *params, 
+			int *p_nbound, char ***p_bound_values);
 
 
 // pgsql.c
@@ -781,7 +822,13 @@ extern Vector *dagNodesFromDoc(xmlNode *root);
 
 
 
+// bindump.c
+extern void binaryDumpWrite(FILE *fp, Document *doc);
+extern boolean isBinaryDump(String *path);
+extern Document *binaryDumpRead(String *path);
+
 // tsort.c
+extern boolean breakCycle(DagNode *node);
 extern Vector *simple_tsort(Vector *nodes);
 extern Vector *tsort(Document *doc);
 
@@ -798,3 +845,7 @@ extern xmlNode *doDiff(String *diffrules, boolean swap);
 // system.c
 extern String *username(void);
 extern String *homedir(void);
+extern int workerStart(int *p_fd);
+extern void workerExit(int fd, char *text, size_t len, boolean ok);
+extern String *workerFinish(int pid, int fd);
+extern void workerAbandon(int pid, int fd);
@@ -13,6 +13,10 @@
  */
 
 #include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "skit.h"
 #include "sql.h"
 #include "exceptions.h"
@@ -66,6 +70,85 @@ getFunctions()
     return functions;
 }
 
+/* When extraction is shared between worker processes (the jobs
+ * option), each worker has its own connection.  So that they all see
+ * the same data, the first connection begins a transaction and exports
+ * its snapshot before any query is run on it; each worker imports that
+ * snapshot when it connects.  The snapshot is ended only by the
+ * process that exported it.
+ */
+static String *shared_snapshot = NULL;
+static Connection *snapshot_connection = NULL;
+static pid_t snapshot_pid = 0;
+
+/* Return the number of worker processes requested by the jobs option,
+ * if any. */
+static int
+jobsRequested()
+{
+    Object *jobs = symbolGetValue("jobs");
+    Int4 *num;
+    int result = 1;
+
+    if (jobs && (jobs->type == OBJ_STRING)) {
+	num = stringToInt4((String *) jobs);
+	result = num->value;
+	objectFree((Object *) num, TRUE);
+    }
+    else if (jobs && (jobs->type == OBJ_INT4)) {
+	result = ((Int4 *) jobs)->value;
+    }
+    return result;
+}
+
+/* Called for each new connection, to begin or join the shared
+ * snapshot.  If the db handler or server cannot share snapshots, the
+ * jobs option is ignored rather than letting workers see different
+ * data: see sqlSharedSnapshot. */
+static void
+connectSnapshot(Connection *connection)
+{
+    if (shared_snapshot) {
+	if (snapshot_pid != getpid()) {
+	    /* We are a worker process. */
+	    sqlImportSnapshot(connection, shared_snapshot);
+	}
+    }
+    else if (jobsRequested() > 1) {
+	if (shared_snapshot = sqlExportSnapshot(connection)) {
+	    snapshot_connection = connection;
+	    snapshot_pid = getpid();
+	}
+	else {
+	    fprintf(stderr, "WARNING: the database server cannot share "
+		    "a snapshot between connections (postgres 9.2 or "
+		    "later is needed), so jobs will be ignored.\n");
+	}
+    }
+}
+
+/* End the shared snapshot, if this process exported it. */
+static void
+endSharedSnapshot()
+{
+    if (shared_snapshot && (snapshot_pid == getpid())) {
+	sqlEndSnapshot(snapshot_connection);
+	objectFree((Object *) shared_snapshot, TRUE);
+	shared_snapshot = NULL;
+	snapshot_connection = NULL;
+	snapshot_pid = 0;
+    }
+}
+
+/* Return the snapshot shared by the connections of worker processes,
+ * or NULL if there is none, in which case rows must not be processed
+ * by workers. */
+String *
+sqlSharedSnapshot()
+{
+    return shared_snapshot;
+}
+
 /* Called to establish a connection, or get the current connection. */
 Connection *
 sqlConnect()
@@ -80,6 +163,9 @@ sqlConnect()
 		  newstr("Db connection function is not registered"));
 	}
 	cur_connection = functions->connect((Object *) functions);
+	if (cur_connection) {
+	    connectSnapshot(cur_connection);
+	}
     }
     if (cur_connection) {
 	return cur_connection;
@@ -96,6 +182,7 @@ sqlConnect()
 void
 finishWithConnection()
 {
+    endSharedSnapshot();
     cur_connection = NULL;
 }
 
@@ -103,6 +190,10 @@ void
 connectionFree(Connection *connection)
 {
     SqlFuncs *functions = (SqlFuncs *) connection->sqlfuncs;
+
+    if (connection == snapshot_connection) {
+	endSharedSnapshot();
+    }
     if (!functions->cleanup) {
 	RAISE(NOT_IMPLEMENTED_ERROR,
 	      newstr("Db cleanup function is not registered"));
@@ -136,6 +227,77 @@ sqlExec(Connection *connection,
     return functions->query(connection, qry, params);
 }
 
+/* Execute each of a list of queries, returning a list of the
+ * resulting cursors in the same order.  Parameters must already have
+ * been applied to the queries.  Db handlers that are able to send many
+ * queries in a single round trip provide a querybatch function;
+ * otherwise the queries are simply executed in turn.
+ */
+Cons *
+sqlExecBatch(Connection *connection, Cons *queries)
+{
+    SqlFuncs *functions = (SqlFuncs *) connection->sqlfuncs;
+    Cons *volatile results = NULL;
+    Cons *qry;
+    Cursor *cursor;
+
+    if (functions->querybatch) {
+	return functions->querybatch(connection, queries);
+    }
+    BEGIN {
+	for (qry = queries; qry; qry = (Cons *) qry->cdr) {
+	    cursor = sqlExec(connection, (String *) qry->car, NULL);
+	    results = consAppend(results, (Object *) cursor);
+	}
+    }
+    EXCEPTION(ex) {
+	objectFree((Object *) results, TRUE);
+    }
+    END;
+    return results;
+}
+
+/* Begin a transaction on connection whose snapshot may be shared
+ * with other connections using sqlImportSnapshot.  Returns an
+ * identifier for the snapshot, or NULL if the db handler or server is
+ * unable to share snapshots.
+ */
+String *
+sqlExportSnapshot(Connection *connection)
+{
+    SqlFuncs *functions = (SqlFuncs *) connection->sqlfuncs;
+
+    if (!functions->exportsnapshot) {
+	return NULL;
+    }
+    return functions->exportsnapshot(connection);
+}
+
+/* Begin a transaction on connection that sees the same data as the
+ * connection that exported snapshot. */
+void
+sqlImportSnapshot(Connection *connection, String *snapshot)
+{
+    SqlFuncs *functions = (SqlFuncs *) connection->sqlfuncs;
+
+    if (!functions->importsnapshot) {
+	RAISE(NOT_IMPLEMENTED_ERROR,
+	      newstr("Db importsnapshot function is not registered"));
+    }
+    functions->importsnapshot(connection, snapshot);
+}
+
+/* End the transaction begun by sqlExportSnapshot. */
+void
+sqlEndSnapshot(Connection *connection)
+{
+    SqlFuncs *functions = (SqlFuncs *) connection->sqlfuncs;
+
+    if (functions->endsnapshot) {
+	functions->endsnapshot(connection);
+    }
+}
+
 /* Does not need to be freed */
 Tuple *
 sqlNextRow(Cursor *cursor)
@@ -149,7 +311,7 @@ sqlNextRow(Cursor *cursor)
     return functions->nextrow(cursor);
 }
 
-static String *
+static Object *
 tupleGetByIdx(Tuple *tuple, int idx)
 {
     Cursor *cursor;
@@ -165,11 +327,11 @@ tupleGetByIdx(Tuple *tuple, int idx)
 	RAISE(NOT_IMPLEMENTED_ERROR,
 	      newstr("Db fieldbyidx function is not registered"));
     }
-    return (String *) functions->fieldbyidx(tuple, idx);
+    return functions->fieldbyidx(tuple, idx);
 }
 
 /* Needs to be freed */
-static String *
+static Object *
 tupleGetByName(Tuple *tuple, String *name)
 {
     Cursor *cursor;
@@ -184,10 +346,13 @@ tupleGetByName(Tuple *tuple, String *name)
 	RAISE(NOT_IMPLEMENTED_ERROR,
 	      newstr("Db fieldbyname function is not registered"));
     }
-    return (String *) functions->fieldbyname(tuple, name);
+    return functions->fieldbyname(tuple, name);
 }
 
-String *
+/* Return the value of a field from tuple.  This may be a String or a
+ * reference to a String owned by the cursor, depending on the db
+ * handler.  Either way, the result must be freed. */
+Object *
 tupleGet(Tuple *tuple, Object *key)
 {
     if (key->type == OBJ_INT4) {
@@ -282,83 +447,250 @@ cursorIndex(Cursor *cursor, String *fieldname)
     return NULL;
 }
 
-static char *
-applyOneParam(char *qrystr, char *pattern, Object *param)
+/* Group the rows of cursor by the values of fieldname.  Unlike
+ * cursorIndex, many rows may share the same key.  Each group is
+ * itself a cursor which shares its result set with the grouped cursor
+ * and may be retrieved using cursorSelect.
+ */
+void *
+cursorGroup(Cursor *cursor, String *fieldname)
 {
-    String *volatile source = NULL;
-    String *volatile replacement = NULL;
-    Regexp *volatile match = NULL;
-    String *result = NULL;
-    char *raw_result;
+    Connection *connection;
+    SqlFuncs *functions;
+    connection = cursor->connection;
+    functions = (SqlFuncs *) connection->sqlfuncs;
+    if (!functions->cursorgroup) {
+	RAISE(NOT_IMPLEMENTED_ERROR,
+	      newstr("Db cursorgroup function is not registered"));
+    }
+    functions->cursorgroup(cursor, fieldname);
+    return NULL;
+}
 
-    if (param->type == OBJ_STRING) {
-	replacement = (String *) objectCopy(param);
+/* Select from a cursor by key.  An integer key selects by row number,
+ * as does any key for a cursor that has been indexed by cursorIndex.
+ * For a cursor that has only been grouped, the result is a reference
+ * to the cursor containing all rows for that key.
+ */
+Object *
+cursorSelect(Cursor *cursor, Object *key)
+{
+    if ((key->type != OBJ_INT4) && (!cursor->index) && cursor->groups) {
+	return (Object *) objRefNew((Object *) cursorGroupGet(cursor, key));
     }
-    else {
-	RAISE(NOT_IMPLEMENTED_ERROR,
-	      newstr("applyOneParam cannot yet deal with non-strings"));
+    return (Object *) cursorGet(cursor, key);
+}
+
+/* Return the group cursor containing the rows of cursor that match
+ * key, or NULL if there are none.  The result belongs to cursor and
+ * must not be freed.
+ */
+Cursor *
+cursorGroupGet(Cursor *cursor, Object *key)
+{
+    cursor = (Cursor *) dereference((Object *) cursor);
+    if (!cursor->groups) {
+	RAISE(GENERAL_ERROR,
+	      newstr("Cannot select group from this cursor - "
+		     "it has not been grouped"));
     }
-    BEGIN {
-	source = stringNewByRef(qrystr);
-	match = regexpNew(pattern);
-	result = regexpReplace(source, match, replacement);
+    return (Cursor *) hashGet(cursor->groups, key);
+}
+
+/* Query parameters appear in query text as :1, :2, etc.  They have
+ * always been substituted textually, and templates rely on this, using
+ * parameters to provide table names and parenthesised lists as well as
+ * values.  Where a parameter is used only as a value, it may instead
+ * be passed to the server as a bind parameter, allowing the server to
+ * re-use the plan for a prepared statement.  A parameter is taken to be
+ * a value if it forms the whole of a quoted literal, as in ':2', or if
+ * it immediately follows a comparison operator, as in = :1.
+ */
+
+/* Return the parameter number of a placeholder at str, or 0 if there
+ * is no placeholder there for any of our nparams parameters.  On
+ * success, *p_end is set to the first character following the
+ * placeholder. */
+static int
+placeholderAt(char *str, int nparams, char **p_end)
+{
+    long n;
+
+    if ((str[0] != ':') || !isdigit((unsigned char) str[1])) {
+	return 0;
     }
-    EXCEPTION(ex);
-    FINALLY {
-	objectFree((Object *) source, FALSE);
-	objectFree((Object *) match, TRUE);
-	objectFree((Object *) replacement, TRUE);
+    n = strtol(str + 1, p_end, 10);
+    return ((n >= 1) && (n <= nparams))? (int) n: 0;
+}
+
+/* Copy len characters of str to out, if out is not NULL, returning
+ * len. */
+static int
+emit(char *out, char *str, int len)
+{
+    if (out) {
+	memcpy(out, str, len);
     }
-    END;
-    raw_result = result->value;
-    objectFree((Object *) result, FALSE);  /* Free the string object but
-					    * not its contents */
-    return raw_result;
+    return len;
 }
 
-static char *
-applyNthParam(char *qrystr, int n, Object *param)
+/* Scan qrystr, substituting parameter values from values, and return
+ * the length of the result.  If bind is TRUE, value parameters are
+ * replaced by $n references, and bound[i] records the $n for
+ * parameter i + 1.  If out is NULL, nothing is written, allowing the
+ * length of the result to be determined before it is built.
+ */
+static int
+scanParams(char *qrystr, String **values, int nparams, boolean bind, 
+	   int *bound, int *p_nbound, char *out)
 {
-    static char *param_str = NULL;
-    if (!param_str) {
-	param_str = malloc(10);
+    char *p = qrystr;
+    char *end;
+    char quote = '\0';
+    char prev = '\0';
+    char numbuf[16];
+    int len = 0;
+    int n;
+
+    while (*p) {
+	if (!quote && (p[0] == '-') && (p[1] == '-')) {
+	    /* Comments are copied unchanged. */
+	    end = strchr(p, '\n');
+	    end = end? end: p + strlen(p);
+	    len += emit(out? out + len: NULL, p, end - p);
+	    p = end;
+	    continue;
+	}
+	if (!quote && bind && (*p == '\'') &&
+	    (n = placeholderAt(p + 1, nparams, &end)) && (*end == '\'')) {
+	    /* A quoted literal consisting of only a placeholder. */
+	    p = end + 1;
+	}
+	else if (!quote && bind && (prev == '=' || prev == '<' || prev == '>') &&
+		 (n = placeholderAt(p, nparams, &end))) {
+	    /* A placeholder following a comparison operator. */
+	    p = end;
+	}
+	else if (n = placeholderAt(p, nparams, &end)) {
+	    /* Substitute the parameter value textually. */
+	    len += emit(out? out + len: NULL, values[n - 1]->value, 
+			strlen(values[n - 1]->value));
+	    p = end;
+	    prev = 'x';
+	    continue;
+	}
+	else {
+	    if (quote && (*p == quote)) {
+		quote = '\0';
+	    }
+	    else if (!quote && ((*p == '\'') || (*p == '"'))) {
+		quote = *p;
+	    }
+	    if (!isspace((unsigned char) *p)) {
+		prev = *p;
+	    }
+	    len += emit(out? out + len: NULL, p, 1);
+	    p++;
+	    continue;
+	}
+
+	/* We have a bind parameter. */
+	if (!bound[n - 1]) {
+	    bound[n - 1] = ++(*p_nbound);
+	}
+	sprintf(numbuf, "$%d", bound[n - 1]);
+	len += emit(out? out + len: NULL, numbuf, strlen(numbuf));
+	prev = 'x';
     }
-    if (param && param->type == OBJ_STRING) {
-	sprintf(param_str, ":%d", n);
-	return applyOneParam(qrystr, param_str, param);
+    if (out) {
+	out[len] = '\0';
     }
-    //dbgSexp(param);
-    RAISE(NOT_IMPLEMENTED_ERROR,
-	  newstr("applyParams cannot deal with non-string objects (%d)",
-		 param? param->type: 0));
-    return NULL;
+    return len;
 }
 
-char *
-applyParams(char *qrystr, Object *params)
+/* Return an array of the String values in params, which may be a
+ * single String or a list of them. */
+static String **
+paramValues(Object *params, int *p_nparams)
 {
+    Cons *list = (params->type == OBJ_CONS)? (Cons *) params: NULL;
+    Object *param = list? list->car: params;
+    String **values;
+    int nparams = list? consLen(list): 1;
+    int i;
+
+    values = (String **) skalloc(sizeof(String *) * nparams);
+    for (i = 0; i < nparams; i++) {
+	if (!(param && param->type == OBJ_STRING)) {
+	    skfree(values);
+	    RAISE(NOT_IMPLEMENTED_ERROR,
+		  newstr("applyParams cannot deal with non-string "
+			 "objects (%d)", param? param->type: 0));
+	}
+	values[i] = (String *) param;
+	if (list && (list = (Cons *) list->cdr)) {
+	    param = list->car;
+	}
+    }
+    *p_nparams = nparams;
+    return values;
+}
+
+static char *
+substituteParams(char *qrystr, Object *params, boolean bind, 
+		 int *p_nbound, char ***p_bound_values)
+{
+    int nparams;
+    String **values = paramValues(params, &nparams);
+    int *bound = (int *) skalloc(sizeof(int) * nparams);
+    char **bound_values;
     char *result;
-    char *prev;
-    Cons *list;
+    int nbound = 0;
+    int len;
     int i;
 
-    if (params->type == OBJ_CONS) {
-	list = (Cons *) params;
-	i = 1;
-	prev = NULL;
-	result = qrystr;
-	while (list) {
-	    result = applyNthParam(result, i, list->car);
-	    if (prev) {
-		skfree(prev);
+    memset(bound, 0, sizeof(int) * nparams);
+    len = scanParams(qrystr, values, nparams, bind, bound, &nbound, NULL);
+    result = skalloc(len + 1);
+    nbound = 0;
+    memset(bound, 0, sizeof(int) * nparams);
+    (void) scanParams(qrystr, values, nparams, bind, bound, &nbound, result);
+
+    if (p_bound_values) {
+	bound_values = nbound? skalloc(sizeof(char *) * nbound): NULL;
+	for (i = 0; i < nparams; i++) {
+	    if (bound[i]) {
+		bound_values[bound[i] - 1] = values[i]->value;
 	    }
-	    prev = result;
-	    i++;
-	    list = (Cons *) list->cdr;
 	}
-	return result;
+	*p_bound_values = bound_values;
+	*p_nbound = nbound;
     }
-    return applyNthParam(qrystr, 1, params);
+    skfree(bound);
+    skfree(values);
+    return result;
+}
+
+/* Return a copy of qrystr with the values from params substituted for
+ * its placeholders. */
+char *
+applyParams(char *qrystr, Object *params)
+{
+    return substituteParams(qrystr, params, FALSE, NULL, NULL);
+}
+
+/* As applyParams() but placeholders used as values are replaced by
+ * $n references for execution with bind parameters.  On return,
+ * *p_bound_values is an array of *p_nbound values for those
+ * references.  The values belong to params; the array, if not NULL,
+ * must be freed by the caller.
+ */
+char *
+bindParams(char *qrystr, Object *params, 
+	   int *p_nbound, char ***p_bound_values)
+{
+    return substituteParams(qrystr, params, TRUE, 
+			    p_nbound, p_bound_values);
 }
 
 String *
@@ -15,6 +15,7 @@
 
 typedef Connection *(ConnectFn)(Object *);
 typedef Cursor *(QueryFn)(Connection *, String *, Object *);
+typedef Cons *(QueryBatchFn)(Connection *, Cons *);
 typedef Tuple *(TupleFn)(Cursor *);
 typedef Object *(FieldByIdxFn)(Tuple *, int);
 typedef Object *(FieldByNameFn)(Tuple *, String *);
@@ -25,21 +26,29 @@ typedef Tuple *(CursorGetFn)(Cursor *, Object *);
 typedef String *(DBQuoteFn)(String *, String *);
 typedef void (CloseCursorFn)(Cursor *);
 typedef void (CloseConnectionFn)(Connection *);
+typedef String *(ExportSnapshotFn)(Connection *);
+typedef void (ImportSnapshotFn)(Connection *, String *);
+typedef void (EndSnapshotFn)(Connection *);
 
 
 typedef struct SqlFuncs {
     ObjType        type;
     ConnectFn     *connect;
     QueryFn       *query;
+    QueryBatchFn  *querybatch;
     TupleFn       *nextrow;
     FieldByIdxFn  *fieldbyidx;
     FieldByNameFn *fieldbyname;
     TupleStrFn    *tuplestr;
     CursorStrFn   *cursorstr;
     CursorIndexFn *cursorindex;
+    CursorIndexFn *cursorgroup;
     CursorGetFn   *cursorget;
     DBQuoteFn     *dbquote;
     CloseCursorFn *closecursor;
     CloseConnectionFn *cleanup;
+    ExportSnapshotFn *exportsnapshot;
+    ImportSnapshotFn *importsnapshot;
+    EndSnapshotFn *endsnapshot;
 } SqlFuncs;
     
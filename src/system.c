@@ -15,10 +15,15 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <pwd.h>
 #include "skit.h"
+#include "exceptions.h"
 
 String *
 username(void)
@@ -37,3 +42,120 @@ homedir(void)
 
     return stringNew(passwd->pw_dir);    
 }
+
+/* Start a worker process.  In the parent this returns the worker's
+ * pid, and *p_fd is set to a descriptor from which the worker's
+ * output may be read.  In the worker it returns 0, and *p_fd is set to
+ * a descriptor to which that output must be written.
+ */
+int
+workerStart(int *p_fd)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) != 0) {
+	RAISE(GENERAL_ERROR,
+	      newstr("Unable to create pipe for worker: %s", 
+		     strerror(errno)));
+    }
+    /* Flush anything buffered so that it is not written twice. */
+    fflush(NULL);
+    if ((pid = fork()) < 0) {
+	close(fds[0]);
+	close(fds[1]);
+	RAISE(GENERAL_ERROR,
+	      newstr("Unable to start worker: %s", strerror(errno)));
+    }
+    if (pid) {
+	close(fds[1]);
+	*p_fd = fds[0];
+    }
+    else {
+	close(fds[0]);
+	*p_fd = fds[1];
+    }
+    return (int) pid;
+}
+
+/* Called in a worker to send its output, or the text of an error, to
+ * the parent and exit.  The worker must not run any cleanup as it
+ * shares resources, such as database connections, with the parent. */
+void
+workerExit(int fd, char *text, size_t len, boolean ok)
+{
+    ssize_t written;
+
+    while (len) {
+	if ((written = write(fd, text, len)) <= 0) {
+	    if ((written < 0) && (errno == EINTR)) {
+		continue;
+	    }
+	    _exit(2);
+	}
+	text += written;
+	len -= written;
+    }
+    close(fd);
+    _exit(ok? 0: 1);
+}
+
+/* Read all output from a worker started by workerStart, and wait for
+ * it to exit.  If the worker failed, an exception is raised using its
+ * output as the error text.  Otherwise the output is returned. 
+ */
+String *
+workerFinish(int pid, int fd)
+{
+    char *buf = skalloc(4096);
+    size_t size = 4096;
+    size_t len = 0;
+    ssize_t bytes;
+    int status;
+    char *errmsg;
+
+    while ((bytes = read(fd, buf + len, size - len - 1)) != 0) {
+	if (bytes < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    break;
+	}
+	len += bytes;
+	if (len + 1 == size) {
+	    size *= 2;
+	    buf = skrealloc(buf, size);
+	}
+    }
+    buf[len] = '\0';
+    close(fd);
+
+    while (waitpid((pid_t) pid, &status, 0) < 0) {
+	if (errno != EINTR) {
+	    status = -1;
+	    break;
+	}
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+	if (WIFEXITED(status) && (WEXITSTATUS(status) == 1)) {
+	    errmsg = newstr("Worker failed: %s", buf);
+	}
+	else {
+	    errmsg = newstr("Worker %d terminated abnormally", pid);
+	}
+	skfree(buf);
+	RAISE(GENERAL_ERROR, errmsg);
+    }
+    return stringNewByRef(buf);
+}
+
+/* Stop a worker started by workerStart whose output is no longer
+ * wanted. */
+void
+workerAbandon(int pid, int fd)
+{
+    close(fd);
+    (void) kill((pid_t) pid, SIGTERM);
+    while ((waitpid((pid_t) pid, NULL, 0) < 0) && (errno == EINTR)) {
+    }
+}
@@ -16,26 +16,6 @@
 #include "exceptions.h"
 
 
-static void
-tsort_node(Vector *nodes, DagNode *node, Vector *results);
-
-static void
-tsort_deps(Vector *nodes, DagNode *node, Vector *results)
-{
-    Vector *deps;
-    int i;
-    DagNode *dep;
-
-    if (deps = node->deps) {
-	EACH(deps, i) {
-	    dep = (DagNode *) ELEM(deps, i);
-	    node->cur_dep = i;
-	    tsort_node(nodes, dep, results);
-	}
-    }
-}
-
-
 static Vector *
 nodesInCycle(DagNode *node)
 {
@@ -67,7 +47,11 @@ applyDDL(Document *doc)
     return result;
 }
 
-static boolean
+/* Attempt to break the cycle of dependencies that starts and ends at
+ * node, by deactivating any node in it whose DDL does nothing.
+ * Returns TRUE if the cycle has been broken.
+ */
+boolean
 breakCycle(DagNode *node)
 {
     Vector *nodes_in_cycle = nodesInCycle(node);
@@ -99,74 +83,146 @@ breakCycle(DagNode *node)
     return result;
 }
 
+/* A frame in the explicit stack used by tsort_node.  Deps is NULL for
+ * nodes whose dependencies are not to be followed, and next is the
+ * index of the next dependency to visit.
+ */
+typedef struct TsortFrame {
+    DagNode *node;
+    Vector  *deps;
+    int      next;
+} TsortFrame;
+
+typedef struct TsortStack {
+    TsortFrame *frames;
+    int         size;
+    int         depth;
+} TsortStack;
+
 static void
-tsort_node(Vector *nodes, DagNode *node, Vector *results)
+tsortPush(TsortStack *stack, DagNode *node)
 {
-    DagNode *cycle_node;
-    boolean cyclic_exception = FALSE;
-    char *errmsg;
+    TsortFrame *frame;
+    if (stack->depth >= stack->size) {
+	stack->size *= 2;
+	stack->frames = (TsortFrame *) skrealloc(
+	    stack->frames, stack->size * sizeof(TsortFrame));
+    }
+    frame = &stack->frames[stack->depth++];
+    frame->node = node;
+    frame->deps = (node->build_type == DEACTIVATED_NODE)? NULL: node->deps;
+    frame->next = 0;
+    node->status = VISITING;
+}
+
+/* Called when the dependency currently being followed from the top of
+ * stack leads to cycle_node, which is already on the stack.  If the
+ * cycle can be broken, the stack is unwound to cycle_node, which will
+ * then be visited again from the start, and NULL is returned.
+ * Otherwise the entire stack is unwound and a description of the
+ * cycle is returned.
+ */
+static char *
+tsortCycle(TsortStack *stack, DagNode *cycle_node)
+{
+    TsortFrame *frame;
+    DagNode *node;
+    char *errmsg = newstr("(%s) %s", nameForBuildType(cycle_node->build_type),
+			  cycle_node->fqn->value);
     char *tmpmsg;
 
-    switch (node->status) {
-    case VISITING:
-	RAISE(TSORT_CYCLIC_DEPENDENCY, 
-	      newstr("(%s) %s", nameForBuildType(node->build_type),
-		     node->fqn->value), node);
-    case UNVISITED: 
-    case RESOLVED: 
-	BEGIN {
-	    node->status = VISITING;
-	    if (node->build_type != DEACTIVATED_NODE) {
-		tsort_deps(nodes, node, results);
+    while (stack->depth) {
+	frame = &stack->frames[stack->depth - 1];
+	node = frame->node;
+	if (node == cycle_node) {
+	    /* We are at the start of the cyclic dependency.  Either
+	     * break the cycle and retry this node, or describe the
+	     * cycle. */
+	    if (breakCycle(node)) {
+		skfree(errmsg);
+		frame->deps = (node->build_type == DEACTIVATED_NODE)? 
+		    NULL: node->deps;
+		frame->next = 0;
+		return NULL;
 	    }
-	    vectorPush(results, (Object *) node);
+	    tmpmsg = newstr("Cyclic dependency detected: (%s) %s->%s", 
+			    nameForBuildType(node->build_type),
+			    node->fqn->value, errmsg);
+	    cycle_node = NULL;
 	}
-	EXCEPTION(ex);
-	WHEN(TSORT_CYCLIC_DEPENDENCY) {
-	    cyclic_exception = TRUE;
-	    cycle_node = (DagNode *) ex->param;
-	    errmsg = newstr("%s", ex->text);
+	else {
+	    /* We are somewhere in the cycle of deps, or on the path
+	     * that led to it.  Add the current node to the error
+	     * message. */ 
+	    tmpmsg = newstr("(%s) %s->%s", 
+			    nameForBuildType(node->build_type),
+			    node->fqn->value, errmsg);
 	}
-	END;
-	if (cyclic_exception) {
-	    if (node == cycle_node) {
-		/* We are at the start of the cyclic dependency.
-		 * Set errmsg to describe this, and reset cycle_node
-		 * for the RAISE below. */ 
-		if (breakCycle(node)) {
-		    /* We have broken the cycle, so we retry this node,
-		     * the simplest way possible. */
-		    node->status = UNVISITED;
-		    skfree(errmsg);
-		    tsort_node(nodes, node, results);
-		    return;
-		}
-		tmpmsg = newstr("Cyclic dependency detected: (%s) %s->%s", 
-				nameForBuildType(node->build_type),
-				node->fqn->value, errmsg);
-		cycle_node = NULL;
-	    }
-	    else  {
-		/* We are somewhere in the cycle of deps.  Add the
-		 * current node to the error message. */ 
-		tmpmsg = newstr("(%s) %s->%s", 
-				nameForBuildType(node->build_type),
-				node->fqn->value, errmsg);
-	    }
-	    
-	    skfree(errmsg);
-	    node->status = UNVISITED;
-	    RAISE(TSORT_CYCLIC_DEPENDENCY, tmpmsg, cycle_node);
-	}
-	node->status = VISITED;
+	skfree(errmsg);
+	errmsg = tmpmsg;
+	node->status = UNVISITED;
+	stack->depth--;
+    }
+    return errmsg;
+}
+
+/* Visit node and, depth first, everything that it depends on, adding
+ * each to results once all of its dependencies have been added.  This
+ * uses an explicit stack rather than recursion so that long chains of
+ * dependencies cannot exhaust the C stack.  If an unbreakable cycle is
+ * found, a description of it is returned; otherwise NULL.
+ */
+static char *
+tsort_node(TsortStack *stack, DagNode *node, Vector *results)
+{
+    TsortFrame *frame;
+    DagNode *dep;
+    char *errmsg;
+
+    switch (node->status) {
+    case UNVISITED: 
+    case RESOLVED: 
+	tsortPush(stack, node);
 	break;
     case VISITED: 
-	break;
+	return NULL;
     default:
 	RAISE(TSORT_ERROR,
-		  newstr("Unexpected status for dagnode %s: %d",
-			 node->fqn->value, node->status));
+	      newstr("Unexpected status for dagnode %s: %d",
+		     node->fqn->value, node->status));
     }
+
+    while (stack->depth) {
+	frame = &stack->frames[stack->depth - 1];
+	node = frame->node;
+	if (frame->deps && (frame->next < frame->deps->elems)) {
+	    node->cur_dep = frame->next++;
+	    dep = (DagNode *) ELEM(frame->deps, node->cur_dep);
+	    switch (dep->status) {
+	    case VISITING: 
+		if (errmsg = tsortCycle(stack, dep)) {
+		    return errmsg;
+		}
+		break;
+	    case UNVISITED: 
+	    case RESOLVED: 
+		tsortPush(stack, dep);
+		break;
+	    case VISITED: 
+		break;
+	    default:
+		RAISE(TSORT_ERROR,
+		      newstr("Unexpected status for dagnode %s: %d",
+			     dep->fqn->value, dep->status));
+	    }
+	}
+	else {
+	    vectorPush(results, (Object *) node);
+	    node->status = VISITED;
+	    stack->depth--;
+	}
+    }
+    return NULL;
 }
 
 Vector *
@@ -174,20 +230,34 @@ simple_tsort(Vector *nodes)
 {
     Vector *volatile results = 
 	vectorNew(nodes->elems + 10); // Allow for expansion
+    TsortStack stack;
     DagNode *node;
+    char *errmsg = NULL;
     int i;
+
+    stack.size = nodes->elems + 10;
+    stack.depth = 0;
+    stack.frames = (TsortFrame *) skalloc(stack.size * sizeof(TsortFrame));
     BEGIN {
 	EACH(nodes, i) {
 	    node = (DagNode *) ELEM(nodes, i);
-	    tsort_node(nodes, node, results);
+	    if (errmsg = tsort_node(&stack, node, results)) {
+		break;
+	    }
 	}
     }
     EXCEPTION(ex);
     WHEN_OTHERS {
+	skfree(stack.frames);
 	objectFree((Object *) results, FALSE);
 	RAISE();
     }
     END;
+    skfree(stack.frames);
+    if (errmsg) {
+	objectFree((Object *) results, FALSE);
+	RAISE(TSORT_CYCLIC_DEPENDENCY, errmsg);
+    }
     return results;
 }
 
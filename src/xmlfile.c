@@ -179,6 +179,109 @@ docForNode(xmlNode *node) {
     return NULL;
 }
 
+/* Return str, or an independently allocated copy of it if it belongs
+ * to dict. */
+static const xmlChar *
+undictString(xmlDict *dict, const xmlChar *str)
+{
+    if (dict && str && xmlDictOwns(dict, str)) {
+	return xmlStrdup(str);
+    }
+    return str;
+}
+
+/* Return a declaration of the xml namespace that is in scope for node,
+ * creating one on node if necessary.  This is how libxml handles the
+ * xml namespace for nodes that are not part of a document. */
+static xmlNs *
+xmlNsFor(xmlNode *node)
+{
+    xmlNode *this;
+    xmlNs *ns;
+
+    for (this = node; this && (this->type == XML_ELEMENT_NODE); 
+	 this = this->parent) {
+	for (ns = this->nsDef; ns; ns = ns->next) {
+	    if (ns->prefix && streq((char *) ns->prefix, "xml")) {
+		return ns;
+	    }
+	}
+    }
+    return xmlSearchNs(NULL, node, (xmlChar *) "xml");
+}
+
+static void detachNodeList(xmlNode *node, xmlDoc *doc);
+
+/* Remove any references that node, and its attributes and descendants,
+ * have to doc, so that they remain valid after doc has been freed.
+ * Names and content may belong to the document's dictionary, which for
+ * the results of xsl processing is that of the stylesheet, and
+ * references to the xml namespace may be to the document's own
+ * declaration of it.  Note that xmlSetTreeDoc() does not deal with
+ * either of these.
+ */
+static void
+detachNode(xmlNode *node, xmlDoc *doc)
+{
+    xmlAttr *attr;
+
+    node->name = undictString(doc->dict, node->name);
+    node->doc = NULL;
+    switch (node->type) {
+    case XML_ELEMENT_NODE:
+	if (node->ns && (node->ns == doc->oldNs)) {
+	    node->ns = xmlNsFor(node);
+	}
+	for (attr = node->properties; attr; attr = attr->next) {
+	    attr->name = undictString(doc->dict, attr->name);
+	    attr->doc = NULL;
+	    if (attr->ns && (attr->ns == doc->oldNs)) {
+		attr->ns = xmlNsFor(node);
+	    }
+	    detachNodeList(attr->children, doc);
+	}
+	detachNodeList(node->children, doc);
+	break;
+    case XML_TEXT_NODE:
+    case XML_CDATA_SECTION_NODE:
+    case XML_COMMENT_NODE:
+    case XML_PI_NODE:
+	if (node->content != (xmlChar *) &(node->properties)) {
+	    node->content = (xmlChar *) undictString(doc->dict, 
+						     node->content);
+	}
+	break;
+    default:;  /* Quieten the compiler warnings. */
+    }
+}
+
+static void
+detachNodeList(xmlNode *node, xmlDoc *doc)
+{
+    for (; node; node = node->next) {
+	detachNode(node, doc);
+    }
+}
+
+/* If node is the root element of a document that has been passed back
+ * to us by reference, as the results of skit:xslproc and skit:tsort
+ * are, take it out of that document and free the rest of the
+ * document, so that node may be added to another tree.  This avoids
+ * making a copy of what may be a very large tree.
+ */
+static xmlNode *
+adoptRoot(xmlNode *node)
+{
+    xmlDoc *doc = node->doc;
+
+    if (doc && doc->_private && (node->parent == (xmlNode *) doc)) {
+	xmlUnlinkNode(node);
+	detachNode(node, doc);
+	objectFree((Object *) doc->_private, TRUE);
+    }
+    return node;
+}
+
 
 /* Handle a skit:stylesheet element */
 static xmlNode *
@@ -234,25 +337,180 @@ ignoreFn(xmlNode *template_node, xmlNode *parent_node, int depth)
     return NULL;
 }
 
+/* Expressions in template attributes are read only once, the first
+ * time that they are evaluated, and are then cached in the _private
+ * field of the template node.  The cache is an alist of (key . entry)
+ * where key is the attribute name, and entry is one of:
+ *   nil, if the node has no such attribute;
+ *   (source . expr), where expr has been read by compileSexp;
+ *   source, if the expression must be evaluated by evalSexp.
+ * Attributes that name a variable are cached separately (see
+ * nodeSymbol), with the key prefixed by SYMBOL_KEY and the entry being
+ * the symbol, or nil.  As no attribute name may begin with SYMBOL_KEY,
+ * the two uses of an attribute cannot collide.
+ * Each node with a cache is recorded in compiled_nodes so that its
+ * cache can be freed before the template document goes away.
+ */
+#define EXPR_KEY ""
+#define SYMBOL_KEY "#"
+
+static Cons *compiled_nodes = NULL;
+static boolean caching_exprs = FALSE;
+
+static Cons *
+findCacheEntry(xmlNode *node, char *prefix, char *attribute_name)
+{
+    Cons *elem;
+    Cons *pair;
+    char *key;
+    int prefix_len = strlen(prefix);
+
+    for (elem = (Cons *) node->_private; elem; elem = (Cons *) elem->cdr) {
+	pair = (Cons *) elem->car;
+	key = ((String *) pair->car)->value;
+	if ((strncmp(key, prefix, prefix_len) == 0) &&
+	    streq(key + prefix_len, attribute_name)) {
+	    return pair;
+	}
+    }
+    return NULL;
+}
+
+static void
+addCacheEntry(xmlNode *node, char *prefix, char *attribute_name, 
+	      Object *entry)
+{
+    Cons *cache = (Cons *) node->_private;
+    Cons *pair;
+
+    if (!cache) {
+	compiled_nodes = consNew((Object *) nodeNew(node), 
+				 (Object *) compiled_nodes);
+    }
+    pair = consNew((Object *) stringNewByRef(
+		       newstr("%s%s", prefix, attribute_name)), entry);
+    node->_private = consNew((Object *) pair, (Object *) cache);
+}
+
+static Object *
+exprCacheEntry(xmlNode *node, char *attribute_name)
+{
+    Cons *pair;
+    String *volatile source;
+    Object *volatile entry = NULL;
+    Object *expr;
+
+    if (pair = findCacheEntry(node, EXPR_KEY, attribute_name)) {
+	return pair->cdr;
+    }
+
+    if (source = nodeAttribute(node, attribute_name)) {
+	BEGIN {
+	    if (compileSexp(source->value, &expr)) {
+		entry = (Object *) consNew((Object *) source, expr);
+	    }
+	    else {
+		entry = (Object *) source;
+	    }
+	}
+	EXCEPTION(ex) {
+	    objectFree((Object *) source, TRUE);
+	}
+	END;
+    }
+
+    addCacheEntry(node, EXPR_KEY, attribute_name, entry);
+    return entry;
+}
+
+/* Return the symbol named by the given attribute of node, or NULL if
+ * there is no such attribute.  The symbol is interned the first time
+ * and thereafter taken directly from the node's cache.
+ */
+static Symbol *
+nodeSymbol(xmlNode *node, char *attribute_name)
+{
+    Cons *pair;
+    String *name;
+    Symbol *sym = NULL;
+
+    if (caching_exprs && 
+	(pair = findCacheEntry(node, SYMBOL_KEY, attribute_name))) {
+	return (Symbol *) pair->cdr;
+    }
+
+    if (name = nodeAttribute(node, attribute_name)) {
+	sym = symbolNew(name->value);
+	objectFree((Object *) name, TRUE);
+    }
+    if (caching_exprs) {
+	addCacheEntry(node, SYMBOL_KEY, attribute_name, (Object *) sym);
+    }
+    return sym;
+}
+
+/* Free the expression caches of all nodes cached since mark was taken
+ * from compiled_nodes. */
+static void
+freeExprCaches(Cons *mark)
+{
+    Cons *elem;
+    Node *node;
+
+    while (compiled_nodes && (compiled_nodes != mark)) {
+	elem = compiled_nodes;
+	compiled_nodes = (Cons *) elem->cdr;
+	node = (Node *) elem->car;
+	objectFree((Object *) node->node->_private, TRUE);
+	node->node->_private = NULL;
+	objectFree((Object *) node, TRUE);
+	objectFree((Object *) elem, FALSE);
+    }
+}
+
 static boolean
 hasExprAttribute(xmlNode *node, Object **p_result, char *attribute_name)
 {
     String *volatile expr;
+    Object *volatile entry = NULL;
     Object *value = NULL;
-    if (expr = nodeAttribute(node, attribute_name)) {
+
+    if (caching_exprs) {
+	if ((entry = exprCacheEntry(node, attribute_name)) &&
+	    (entry->type == OBJ_CONS)) {
+	    expr = (String *) ((Cons *) entry)->car;
+	}
+	else {
+	    expr = (String *) entry;
+	}
+    }
+    else {
+	expr = nodeAttribute(node, attribute_name);
+    }
+
+    if (expr) {
 	BEGIN {
-	    value = evalSexp(expr->value);
+	    if (entry && (entry->type == OBJ_CONS)) {
+		value = evalCompiled(((Cons *) entry)->cdr);
+	    }
+	    else {
+		value = evalSexp(expr->value);
+	    }
 	}
 	EXCEPTION(ex) {
 	    WHEN(LIST_ERROR) {
 		char *newtext = newstr("%s in expr:\n%s", 
 				       ex->text, expr->value);
-		objectFree((Object *) expr, TRUE);
+		if (!entry) {
+		    objectFree((Object *) expr, TRUE);
+		}
 		RAISE(LIST_ERROR, newtext);
 	    } 
 	}
 	FINALLY {
-	    objectFree((Object *) expr, TRUE);
+	    if (!entry) {
+		objectFree((Object *) expr, TRUE);
+	    }
 	}
 	END;
 	*p_result = value;
@@ -284,62 +542,448 @@ getExpr(xmlNode *node)
     return value;
 }
 
-static String *
-fieldValueForTemplate(xmlNode *template_node)
+/* Return value as a String that belongs to the caller, consuming
+ * value.  Strings are returned as they are, and other objects are
+ * converted using objectSexp.  If value is a reference, the referenced
+ * object belongs to someone else (eg the cursor from which a field
+ * value was selected) so the String must be copied.
+ */
+static String *
+stringForValue(Object *value)
+{
+    Object *actual = dereference(value);
+    String *result;
+
+    if (!actual) {
+	result = NULL;
+    }
+    else if (actual->type != OBJ_STRING) {
+	result = stringNewByRef(objectSexp(actual));
+    }
+    else if (value->type == OBJ_OBJ_REFERENCE) {
+	result = (String *) objectCopy(actual);
+    }
+    else {
+	return (String *) value;
+    }
+    objectFree(value, TRUE);
+    return result;
+}
+
+static String *
+fieldValueForTemplate(xmlNode *template_node)
+{
+    String *volatile field = NULL;
+    Object *value = NULL;
+
+    if (hasExpr(template_node, &value)) {
+	return stringForValue(value);
+    }
+
+    /* Get string from the current tuple's field as named in 
+       the name or field attribute. */
+    field = nodeAttribute(template_node, "field");
+	
+    if (!field) {
+	field = nodeAttribute(template_node, "name");
+    }
+	
+    BEGIN {
+	value = objSelect(curTuple(), (Object *) field);
+    }
+    EXCEPTION(ex);
+    WHEN(NOT_IMPLEMENTED_ERROR) {
+	char *exstr;
+	char *tmp = objectSexp((Object *) field);
+	objectFree((Object *) field, TRUE);
+	exstr = newstr("Unable to select %s from current foreach record",
+		       tmp);
+	skfree(tmp);
+
+	RAISE(XML_PROCESSING_ERROR, exstr);
+    }
+    END;
+
+    objectFree((Object *) field, TRUE);
+    return stringForValue(value);
+}
+
+/* Streamed output.  While an output stream is open (see
+ * beginOutputStream()), each literal element that processTemplate
+ * builds has a StreamFrame.  Once an element has been completed and is
+ * about to be added to a parent that lies on the unbroken chain of
+ * literal elements from the document root, it is written to the stream
+ * and freed, rather than being added to the parent.  The parent's start
+ * tag is written when its first child is streamed, which is only once
+ * the template can no longer add attributes to it (see
+ * attributesMayFollow()).  Until then, its children are retained.  This
+ * means that only the elements along the current path from the root,
+ * and whatever has been produced for the current child, are held in
+ * memory.
+ *
+ * Processors that may need to look at the elements produced by their
+ * children, such as skit:xslproc and skit:tsort, push a barrier frame
+ * (one with no node).  Everything built beneath a barrier is kept in
+ * memory as usual and is streamed only when it is added, complete, to a
+ * streamable element.
+ *
+ * The output is formatted in the same way as by documentPrintXML(),
+ * except that non-ascii characters in text nodes are written as utf-8
+ * rather than as character references.
+ */
+typedef struct StreamFrame {
+    xmlNode *node;
+    xmlNode *template;     /* The template node from which node was copied */
+    boolean  streamable;
+    boolean  opened;
+    int      level;
+    struct StreamFrame *prev;
+} StreamFrame;
+
+static xmlOutputBuffer *output_stream = NULL;
+static StreamFrame *stream_frames = NULL;
+
+static StreamFrame *
+streamPush(xmlNode *node, xmlNode *template_node, xmlNode *parent_node)
+{
+    StreamFrame *frame;
+
+    if (!output_stream) {
+	return NULL;
+    }
+    frame = (StreamFrame *) skalloc(sizeof(StreamFrame));
+    frame->node = node;
+    frame->template = template_node;
+    frame->opened = FALSE;
+    frame->prev = stream_frames;
+    if (!node) {
+	frame->streamable = FALSE;
+	frame->level = 0;
+    }
+    else if (frame->prev) {
+	frame->streamable = frame->prev->streamable;
+	frame->level = frame->prev->level + 1;
+    }
+    else {
+	/* Only an element with no parent, created outside of any
+	 * barrier, can be the root of the output document. */
+	frame->streamable = (parent_node == NULL);
+	frame->level = 0;
+    }
+    stream_frames = frame;
+    return frame;
+}
+
+static void
+streamPop(StreamFrame *frame)
+{
+    if (frame) {
+	stream_frames = frame->prev;
+	skfree(frame);
+    }
+}
+
+static void
+streamIndent(int level)
+{
+    while (level-- > 0) {
+	xmlOutputBufferWrite(output_stream, 2, "  ");
+    }
+}
+
+static void
+streamName(xmlNode *node)
+{
+    if (node->ns && node->ns->prefix) {
+	xmlOutputBufferWriteString(output_stream, (char *) node->ns->prefix);
+	xmlOutputBufferWrite(output_stream, 1, ":");
+    }
+    xmlOutputBufferWriteString(output_stream, (char *) node->name);
+}
+
+/* Write node, at the given indentation level, to the output stream,
+ * omitting the final trim characters. */
+static void
+streamDump(xmlNode *node, int level, int trim)
+{
+    xmlBuffer *buf = xmlBufferCreate();
+    int len = xmlNodeDump(buf, node->doc, node, level, 1);
+
+    if (len < trim) {
+	xmlBufferFree(buf);
+	RAISE(XML_PROCESSING_ERROR, 
+	      newstr("Unable to stream element %s", nodeName(node)));
+    }
+    streamIndent(level);
+    xmlOutputBufferWrite(output_stream, len - trim, 
+			 (char *) xmlBufferContent(buf));
+    xmlBufferFree(buf);
+}
+
+/* Write child, which must be complete, as the next child of the
+ * element in frame, and free it. */
+static void
+streamChild(StreamFrame *frame, xmlNode *child)
+{
+    streamDump(child, frame->level + 1, 0);
+    xmlOutputBufferWrite(output_stream, 1, "\n");
+    xmlFreeNode(child);
+}
+
+/* Stream any children that have been added directly to the element in
+ * frame, without going through streamAdd() (eg by skit:element), or
+ * that were added before the element could be opened. */
+static void
+streamRetained(StreamFrame *frame)
+{
+    xmlNode *child;
+
+    while (child = frame->node->children) {
+	xmlUnlinkNode(child);
+	streamChild(frame, child);
+    }
+}
+
+/* Write the start tag for the element in frame, after first writing
+ * those of any of its ancestors that have not yet been written, along
+ * with any children that its parent has retained.  The tag is produced
+ * by dumping the element without its children, which gives us "<name
+ * attrs/>", and then dropping the final "/>".
+ */
+static void
+streamOpen(StreamFrame *frame)
+{
+    xmlNode *node = frame->node;
+    xmlNode *children = node->children;
+    xmlNode *last = node->last;
+
+    if (frame->opened) {
+	return;
+    }
+    if (frame->prev) {
+	streamOpen(frame->prev);
+	streamRetained(frame->prev);
+    }
+    else {
+	xmlOutputBufferWriteString(output_stream, "<?xml version=\"1.0\"?>\n");
+    }
+
+    node->children = node->last = NULL;
+    BEGIN {
+	streamDump(node, frame->level, 2);
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	node->children = children;
+	node->last = last;
+    }
+    END;
+    xmlOutputBufferWrite(output_stream, 2, ">\n");
+    frame->opened = TRUE;
+}
+
+static boolean
+hasTextChild(xmlNode *node)
+{
+    xmlNode *child;
+
+    for (child = node->children; child; child = child->next) {
+	if (child->type != XML_ELEMENT_NODE) {
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+/* Identify whether template_node may add attributes to the element
+ * that its parent is building.  Attributes inside literal elements, or
+ * skit:element, belong to those elements.  We cannot tell what a
+ * function or an unprocessed inclusion might do, so assume the worst.
+ */
+static boolean
+mayAddAttributes(xmlNode *template_node)
+{
+    xmlNode *child;
+    char *prefix;
+    char *name = (char *) template_node->name;
+
+    if (template_node->type != XML_ELEMENT_NODE) {
+	return FALSE;
+    }
+    if (!(template_node->ns && (prefix = (char *) template_node->ns->prefix))) {
+	return FALSE;
+    }
+    if (streq(prefix, "xi")) {
+	return TRUE;
+    }
+    if (!streq(prefix, "skit")) {
+	return FALSE;
+    }
+    if (streq(name, "attr") || streq(name, "attribute") ||
+	streq(name, "exec_func") || streq(name, "exec_function")) {
+	return TRUE;
+    }
+    if (streq(name, "element") || streq(name, "function")) {
+	return FALSE;
+    }
+    for (child = template_node->children; child; child = child->next) {
+	if (mayAddAttributes(child)) {
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+/* Identify whether, once the output from template node pos has been
+ * added to it, the element built from template_node might yet gain
+ * attributes.  That is the case if anything that follows pos, or any
+ * of pos's ancestors up to template_node, may add attributes, or if
+ * pos lies within a loop that may do so.  If pos is not within
+ * template_node at all (eg it is from a function body) we cannot
+ * tell, and so assume that it might.
+ */
+static boolean
+attributesMayFollow(xmlNode *template_node, xmlNode *pos)
+{
+    xmlNode *node;
+    xmlNode *next;
+
+    for (node = pos; node && (node != template_node); node = node->parent) {
+	if ((node != pos) && node->ns && 
+	    streq((char *) node->ns->prefix, "skit") &&
+	    (streq((char *) node->name, "foreach") ||
+	     streq((char *) node->name, "runsql")) &&
+	    mayAddAttributes(node)) {
+	    return TRUE;
+	}
+	for (next = node->next; next; next = next->next) {
+	    if (mayAddAttributes(next)) {
+		return TRUE;
+	    }
+	}
+    }
+    return node == NULL;
+}
+
+/* Check whether the element in frame, and any of its ancestors whose
+ * start tags have not yet been written, may be streamed now that the
+ * output of template node pos is to be added to it.  Mixed content is
+ * printed without indentation, so an element that already contains
+ * text must be printed as a whole once it is complete.  Such an
+ * element, and the one in frame, are marked as not streamable.  An
+ * element that may yet gain attributes cannot be opened now, but may
+ * be later. */
+static boolean
+streamOpenable(StreamFrame *frame, xmlNode *pos)
+{
+    StreamFrame *this;
+
+    for (this = frame; this && !this->opened; this = this->prev) {
+	if (this->streamable && hasTextChild(this->node)) {
+	    this->streamable = FALSE;
+	}
+	if (!this->streamable) {
+	    frame->streamable = FALSE;
+	    return FALSE;
+	}
+	if (attributesMayFollow(this->template, pos)) {
+	    return FALSE;
+	}
+	pos = this->template;
+    }
+    return TRUE;
+}
+
+/* Called when child, the output of template node pos, is about to be
+ * added to parent_node.  If parent_node is streamable, and can be
+ * opened, child is written to the output stream and freed, and TRUE is
+ * returned.
+ */
+static boolean
+streamAdd(xmlNode *parent_node, xmlNode *child, xmlNode *pos)
+{
+    StreamFrame *frame = stream_frames;
+
+    if (!(output_stream && frame && frame->streamable &&
+	  (frame->node == parent_node))) {
+	return FALSE;
+    }
+    if (!streamOpenable(frame, pos)) {
+	return FALSE;
+    }
+    streamOpen(frame);
+    streamRetained(frame);
+    streamChild(frame, child);
+    return TRUE;
+}
+
+/* Called when the element in frame is complete.  If its start tag has
+ * been streamed, its remaining children and its end tag are streamed,
+ * the element is freed, and NULL is returned.  The root element is
+ * always streamed.  Otherwise node is returned, to be added to its
+ * parent in the usual way.
+ */
+static xmlNode *
+streamClose(StreamFrame *frame, xmlNode *node)
+{
+    if (!(frame && frame->streamable)) {
+	return node;
+    }
+    if (frame->opened) {
+	streamRetained(frame);
+	streamIndent(frame->level);
+	xmlOutputBufferWrite(output_stream, 2, "</");
+	streamName(node);
+	xmlOutputBufferWrite(output_stream, 2, ">\n");
+    }
+    else if (!frame->prev) {
+	xmlOutputBufferWriteString(output_stream, "<?xml version=\"1.0\"?>\n");
+	streamDump(node, 0, 0);
+	xmlOutputBufferWrite(output_stream, 1, "\n");
+    }
+    else {
+	return node;
+    }
+    xmlFreeNode(node);
+    if (!frame->prev) {
+	xmlOutputBufferFlush(output_stream);
+    }
+    return NULL;
+}
+
+/* Raise an error if node's start tag has already been streamed, as
+ * what (an attribute or text) can no longer be added to it. */
+static void
+streamCheckOpen(xmlNode *node, char *what)
 {
-    String *volatile field = NULL;
-    Object *value = NULL;
-    Object *actual;
-    String *strvalue = NULL;
+    StreamFrame *frame;
 
-    if (hasExpr(template_node, &value)) {
-	if (value) {
-	    /* If value is a String then we return it.  If it is not
-	     * then we use objectSexp.  If it is a string reference we
-	     * must make a copy. */
-
-	    actual = dereference(value);
-	    if (actual->type != OBJ_STRING) {
-		strvalue = stringNewByRef(objectSexp(actual));
-		objectFree(value, TRUE);
-	    }
-	    else if (value->type == OBJ_OBJ_REFERENCE) {
-		strvalue = (String *) objectCopy(dereference(value));
-		objectFree(value, TRUE);
-	    }
-	    else {
-		strvalue = (String *) value;
-	    }
+    for (frame = stream_frames; frame; frame = frame->prev) {
+	if ((frame->node == node) && frame->opened) {
+	    RAISE(XML_PROCESSING_ERROR, 
+		  newstr("Cannot add %s to %s: element has already "
+			 "been streamed", what, nodeName(node)));
 	}
     }
-    else {
-	/* Get string from the current tuple's field as named in 
-	   the name or field attribute. */
-	field = nodeAttribute(template_node, "field");
-	
-	if (!field) {
-	    field = nodeAttribute(template_node, "name");
-	}
-	
-	BEGIN {
-	    strvalue = (String *) objSelect(curTuple(), (Object *) field);
-	}
-	EXCEPTION(ex);
-	WHEN(NOT_IMPLEMENTED_ERROR) {
-	    char *exstr;
-	    char *tmp = objectSexp((Object *) field);
-	    objectFree((Object *) field, TRUE);
-	    exstr = newstr("Unable to select %s from current foreach record",
-			   tmp);
-	    skfree(tmp);
+}
 
-	    RAISE(XML_PROCESSING_ERROR, exstr);
-	}
-	END;
-    }
+/* Start streaming the output of processTemplate to fp. */
+void
+beginOutputStream(FILE *fp)
+{
+    output_stream = xmlOutputBufferCreateFile(fp, NULL);
+}
 
-    objectFree((Object *) field, TRUE);
-    return strvalue;
+void
+endOutputStream()
+{
+    while (stream_frames) {
+	streamPop(stream_frames);
+    }
+    if (output_stream) {
+	(void) xmlOutputBufferClose(output_stream);
+	output_stream = NULL;
+    }
 }
 
 /* Handle a skit:attr or akit:attribute element.  The context node,
@@ -363,6 +1007,9 @@ attributeFn(xmlNode *template_node, xmlNode *parent_node, int depth)
     }
     BEGIN {
 	str = fieldValueForTemplate(template_node);
+	if (output_stream && str) {
+	    streamCheckOpen(parent_node, "attribute");
+	}
 	addAttribute(parent_node, name, str);
     }
     EXCEPTION(ex);
@@ -377,26 +1024,23 @@ attributeFn(xmlNode *template_node, xmlNode *parent_node, int depth)
 static xmlNode *
 elementFn(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *volatile expr = nodeAttribute(template_node, "expr");
     String *volatile name;
     xmlNode *elem;
     xmlNode *child = NULL;
 
     UNUSED(depth);
 
-    if (!expr) {
+    if (!hasExpr(template_node, (Object **) &name)) {
 	RAISE(XML_PROCESSING_ERROR,
 	      newstr("No expr field provided for skit_element"));
     }
     BEGIN {
-	name = (String *) evalSexp(expr->value);
 	elem = addElement(parent_node, (String *) dereference((Object *) name));
 	child = processChildren(template_node, elem, depth + 1);
     }
     EXCEPTION(ex);
     FINALLY {
 	objectFree((Object *) name, TRUE);
-	objectFree((Object *) expr, TRUE);
     }
     END;
     return child;
@@ -409,8 +1053,17 @@ textFn(xmlNode *template_node, xmlNode *parent_node, int depth)
     UNUSED(depth);
 
     if (str = fieldValueForTemplate(template_node)) {
-	addText(parent_node, str);
-	objectFree((Object *) str, TRUE);
+	BEGIN {
+	    if (output_stream) {
+		streamCheckOpen(parent_node, "text");
+	    }
+	    addText(parent_node, str);
+	}
+	EXCEPTION(ex);
+	FINALLY {
+	    objectFree((Object *) str, TRUE);
+	}
+	END;
     }
     return NULL;
 }
@@ -470,39 +1123,31 @@ appendToMapVar(Object *obj)
 static xmlNode *
 execResult(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *volatile expr = nodeAttribute(template_node, "expr");
     Object *obj;
     UNUSED(parent_node);
     UNUSED(depth);
 
-    if (!expr) {
+    if (!hasExpr(template_node, &obj)) {
 	RAISE(XML_PROCESSING_ERROR, 
 	      newstr("expr must be specified for skit:result"));
     }
-    BEGIN {
-	obj = evalSexp(expr->value);
-	appendToMapVar(obj);
-    }
-    EXCEPTION(ex);
-    FINALLY {
-	objectFree((Object *) expr, TRUE);
-    }
-    END;
+    appendToMapVar(obj);
     return NULL;
 }
 
+/* Iterate over the rows of collection, processing the children of
+ * template_node for each one.  The first skip rows are passed over,
+ * and at most count rows are processed, unless count is negative. */
 static xmlNode *
-iterate(Object *collection, String *filter,
-	xmlNode *template_node, xmlNode *parent_node, int depth)
+iterateRows(Object *collection, char *filter,
+	    xmlNode *template_node, xmlNode *parent_node, int depth,
+	    int skip, int count)
 {
     Object *volatile tuple;
     Object *volatile placeholder = NULL;
-    String *volatile varname = nodeAttribute(template_node, "var");
-    String *volatile key = nodeAttribute(template_node, "key");
-    String *volatile idxname = nodeAttribute(template_node, "index");
     String *volatile mapname = nodeAttribute(template_node, "map_to");
-    Symbol *volatile varsym = NULL;
-    Symbol *volatile idxsym = NULL;
+    Symbol *volatile varsym = nodeSymbol(template_node, "var");
+    Symbol *volatile idxsym = nodeSymbol(template_node, "index");
     Int4 *volatile idx = NULL;
     xmlNode *first_child = NULL;
     xmlNode *child;
@@ -513,15 +1158,13 @@ iterate(Object *collection, String *filter,
 	newMapSymbol(mapname);
     }
 
-    if (varname || idxname) {
+    if (varsym || idxsym) {
 	newSymbolScope();
     }   
-    if (varname) {
-	varsym = symbolNew(varname->value);
+    if (varsym) {
 	setScopeForSymbol(varsym);
     }
-    if (idxname) {
-	idxsym = symbolNew(idxname->value);
+    if (idxsym) {
 	setScopeForSymbol(idxsym);
 	idx = int4New(0);
 	idxsym->svalue = (Object *) idx;
@@ -536,10 +1179,18 @@ iterate(Object *collection, String *filter,
 	    if (idx) {
 		idx->value++;
 	    }
+	    if (skip) {
+		skip--;
+		objectFree(tuple, TRUE);
+		continue;
+	    }
+	    if (!count--) {
+		objectFree(tuple, TRUE);
+		break;
+	    }
 	    tuplestackPush(tuple);
 	    
-	    if (filter) {
-		result = evalSexp(filter->value);
+	    if (filter && hasExprAttribute(template_node, &result, filter)) {
 		do_it = (result != NULL);
 		objectFree(result, TRUE);
 	    }
@@ -572,16 +1223,13 @@ iterate(Object *collection, String *filter,
 	    varsym->svalue = NULL;
 	}
 
-	if (varname || idxname) {
+	if (varsym || idxsym) {
 	    dropSymbolScope();
 	}
 	if (mapname) {
 	    popMapSymbol();
 	    objectFree((Object *) mapname, TRUE);
 	}
-	objectFree((Object *) key, TRUE);
-	objectFree((Object *) idxname, TRUE);
-	objectFree((Object *) varname, TRUE);
 	objectFree((Object *) placeholder, TRUE);
     }
     END;
@@ -589,44 +1237,358 @@ iterate(Object *collection, String *filter,
     return first_child;
 }
 
+/* Return the number of worker processes that should be used to
+ * iterate over the rows for template_node, from its jobs attribute. */
+static int
+jobsForNode(xmlNode *template_node)
+{
+    Object *volatile jobs;
+    Int4 *volatile num = NULL;
+    Object *actual;
+    int result = 1;
+
+    if (!hasExprAttribute(template_node, (Object **) &jobs, "jobs")) {
+	return 1;
+    }
+    BEGIN {
+	actual = dereference(jobs);
+	if (actual && (actual->type == OBJ_STRING)) {
+	    num = stringToInt4((String *) actual);
+	    actual = (Object *) num;
+	}
+	if (actual && (actual->type == OBJ_INT4)) {
+	    result = ((Int4 *) actual)->value;
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree(jobs, TRUE);
+	objectFree((Object *) num, TRUE);
+    }
+    END;
+    return result;
+}
+
+static boolean in_worker = FALSE;
+
+/* The body of a worker process started by iterateParallel.  This
+ * processes its share of the rows, on its own database connection,
+ * and sends the resulting XML back to the parent.  It never returns.
+ */
+static void
+runWorker(int fd, Object *collection, char *filter,
+	  xmlNode *template_node, int depth, int skip, int count)
+{
+    xmlDocPtr doc;
+    xmlNode *root;
+    xmlChar *buf = NULL;
+    int len = 0;
+    Symbol *sym;
+
+    in_worker = TRUE;
+    /* Our output goes back to the parent, not to its output stream. */
+    output_stream = NULL;
+    BEGIN {
+	/* The parent's connection cannot be shared, so make our own.
+	 * This joins the parent's snapshot: see sqlConnect.  The
+	 * parent's connection is forgotten rather than freed, as closing
+	 * it here would close it for the parent too. */
+	if (sym = symbolGet("dbconnection")) {
+	    sym->svalue = NULL;
+	}
+	finishWithConnection();
+	(void) sqlConnect();
+	doc = xmlNewDoc((xmlChar *) "1.0");
+	root = xmlNewNode(NULL, (xmlChar *) "worker");
+	xmlDocSetRootElement(doc, root);
+	(void) iterateRows(collection, filter, template_node, root, 
+			   depth, skip, count);
+	xmlDocDumpMemory(doc, &buf, &len);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	workerExit(fd, ex->text, strlen(ex->text), FALSE);
+    }
+    END;
+    workerExit(fd, (char *) buf, len, TRUE);
+}
+
+/* Add the nodes from the output of a worker, produced from
+ * template_node, to parent_node.  If parent_node is being streamed, the
+ * nodes are streamed as they are added.  Re-parsing the output costs
+ * roughly 30ms per MB (about 1 second for a 30MB extract), which is
+ * small next to the catalog queries the workers run.  The parsed nodes
+ * are moved rather than copied, which would take as long again, so the
+ * document is parsed without a dictionary: its strings must belong to
+ * the nodes themselves. */
+static void
+addWorkerOutput(xmlNode *parent_node, String *output, xmlNode *template_node)
+{
+    xmlDocPtr doc = xmlReadMemory(output->value, strlen(output->value),
+				  NULL, NULL, XML_PARSE_NODICT);
+    xmlNode *node;
+    xmlNode *next;
+
+    objectFree((Object *) output, TRUE);
+    if (!doc) {
+	RAISE(XML_PROCESSING_ERROR, 
+	      newstr("Unable to parse output from worker"));
+    }
+    for (node = xmlDocGetRootElement(doc)->children; node; node = next) {
+	next = node->next;
+	xmlUnlinkNode(node);
+	xmlSetTreeDoc(node, parent_node->doc);
+	if (!streamAdd(parent_node, node, template_node)) {
+	    xmlAddChild(parent_node, node);
+	}
+    }
+    xmlFreeDoc(doc);
+}
+
+/* Iterate over the rows of cursor using jobs worker processes, each
+ * of which handles a contiguous share of the rows.  The workers share
+ * the snapshot taken when our connection was made, so that they all
+ * see the same data.  Worker output is added to
+ * parent_node in row order, so the result is the same as if the rows
+ * had been processed here.  As for iterateRows(), nothing is returned,
+ * as everything is added to parent_node.  Only the nodes that workers
+ * add to parent_node are kept: anything else, such as variable
+ * assignments, is lost when a worker exits.
+ */
+static xmlNode *
+iterateParallel(Cursor *cursor, char *filter, xmlNode *template_node, 
+		xmlNode *parent_node, int depth, int jobs)
+{
+    int *volatile pids;
+    int *volatile fds;
+    volatile int started = 0;
+    int worker;
+    int first;
+    int next;
+
+    if (jobs > cursor->rows) {
+	jobs = cursor->rows;
+    }
+    pids = (int *) skalloc(sizeof(int) * jobs);
+    fds = (int *) skalloc(sizeof(int) * jobs);
+
+    BEGIN {
+	for (worker = 0; worker < jobs; worker++) {
+	    first = (cursor->rows * worker) / jobs;
+	    next = (cursor->rows * (worker + 1)) / jobs;
+	    if (!(pids[worker] = workerStart(&(fds[worker])))) {
+		runWorker(fds[worker], (Object *) cursor, filter, 
+			  template_node, depth, first, next - first);
+	    }
+	    started++;
+	}
+	for (worker = 0; worker < jobs; worker++) {
+	    addWorkerOutput(parent_node, 
+			    workerFinish(pids[worker], fds[worker]),
+			    template_node);
+	    pids[worker] = 0;
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	for (worker = 0; worker < started; worker++) {
+	    if (pids[worker]) {
+		workerAbandon(pids[worker], fds[worker]);
+	    }
+	}
+	skfree((void *) pids);
+	skfree((void *) fds);
+    }
+    END;
+    return NULL;
+}
+
+/* Iterate over the rows of collection.  If template_node has a jobs
+ * attribute greater than 1, and collection is a cursor, the rows are
+ * processed by that many worker processes, provided that they can
+ * share a snapshot.
+ */
+static xmlNode *
+iterate(Object *collection, char *filter,
+	xmlNode *template_node, xmlNode *parent_node, int depth)
+{
+    Object *actual = dereference(collection);
+    int jobs;
+
+    if (parent_node && (!in_worker) && 
+	actual && (actual->type == OBJ_CURSOR) && 
+	(((Cursor *) actual)->rows > 1) && sqlSharedSnapshot() &&
+	((jobs = jobsForNode(template_node)) > 1)) {
+	return iterateParallel((Cursor *) actual, filter, template_node,
+			       parent_node, depth, jobs);
+    }
+    return iterateRows(collection, filter, template_node, parent_node, 
+		       depth, 0, -1);
+}
+
+/* Cursors for skit:runsql elements whose queries have already been
+ * executed, as part of a batch sent for an earlier sibling.  This is
+ * an alist of (node . cursor).
+ */
+static Cons *prefetched = NULL;
+
+static Cursor *
+takePrefetched(xmlNode *template_node)
+{
+    Cons **p_elem;
+    Cons *elem;
+    Cons *entry;
+    Cursor *cursor;
+
+    for (p_elem = &prefetched; elem = *p_elem; 
+	 p_elem = (Cons **) &(elem->cdr)) {
+	entry = (Cons *) elem->car;
+	if (((Node *) entry->car)->node == template_node) {
+	    *p_elem = (Cons *) elem->cdr;
+	    cursor = (Cursor *) entry->cdr;
+	    objectFree(entry->car, TRUE);
+	    objectFree((Object *) entry, FALSE);
+	    objectFree((Object *) elem, FALSE);
+	    return cursor;
+	}
+    }
+    return NULL;
+}
+
+static void
+freePrefetched()
+{
+    objectFree((Object *) prefetched, TRUE);
+    prefetched = NULL;
+}
+
+/* Identify whether node is a skit:runsql element whose query may be
+ * executed ahead of time.  Queries with parameters may depend on the
+ * results of earlier queries, so cannot be.  */
+static boolean
+isBatchableRunsql(xmlNode *node)
+{
+    xmlNs *ns = node->ns;
+
+    return ns && streq((char *) ns->prefix, "skit") &&
+	streq((char *) node->name, "runsql") &&
+	xmlHasProp(node, (xmlChar *) "to") &&
+	xmlHasProp(node, (xmlChar *) "file") &&
+	!xmlHasProp(node, (xmlChar *) "params");
+}
+
+/* Execute the query for template_node along with those of any
+ * immediately following skit:runsql siblings that assign their
+ * results to variables.  This allows the db handler to send the whole
+ * batch in a single round trip.  The cursors for the siblings are
+ * recorded in prefetched, and the cursor for template_node is
+ * returned.
+ */
+static Cursor *
+execRunsqlBatch(Connection *conn, xmlNode *template_node, String *sqltext)
+{
+    Cons *volatile queries = consNew((Object *) stringNew(sqltext->value), 
+				     NULL);
+    Cons *volatile nodes = NULL;
+    Cons *volatile results = NULL;
+    String *volatile filename;
+    String *volatile filetext;
+    xmlNode *node;
+    Cursor *cursor = NULL;
+    Object *sibling;
+
+    BEGIN {
+	for (node = template_node->next; node; node = node->next) {
+	    if (node->type != XML_ELEMENT_NODE) {
+		continue;
+	    }
+	    if (!isBatchableRunsql(node)) {
+		break;
+	    }
+	    filename = nodeAttribute(node, "file");
+	    filetext = readFile(filename);
+	    objectFree((Object *) filename, TRUE);
+	    if (!filetext) {
+		/* Leave this for the sibling to report. */
+		break;
+	    }
+	    queries = consAppend(queries, (Object *) trimSqlText(filetext));
+	    objectFree((Object *) filetext, TRUE);
+	    nodes = consAppend(nodes, (Object *) nodeNew(node));
+	}
+
+	if (!nodes) {
+	    cursor = sqlExec(conn, sqltext, NULL);
+	}
+	else {
+	    results = sqlExecBatch(conn, queries);
+	    cursor = (Cursor *) consPop((Cons **) &results);
+	    while (nodes) {
+		sibling = consPop((Cons **) &nodes);
+		prefetched = consNew((Object *) consNew(
+					 sibling, consPop((Cons **) &results)),
+				     (Object *) prefetched);
+	    }
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree((Object *) queries, TRUE);
+	objectFree((Object *) nodes, TRUE);
+	objectFree((Object *) results, TRUE);
+    }
+    END;
+    return cursor;
+}
+
 static xmlNode *
 execRunsql(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
     String *volatile filename = nodeAttribute(template_node, "file");
-    String *volatile varname = nodeAttribute(template_node, "to");
+    Symbol *volatile sym = nodeSymbol(template_node, "to");
     String *volatile hashkey = nodeAttribute(template_node, "hash");
+    String *volatile groupkey = nodeAttribute(template_node, "group");
     String *volatile filetext = NULL;
     Cursor *volatile cursor = NULL;
     String *volatile sqltext = NULL;
     Object *volatile params = NULL;
     Connection *conn;
     xmlNode *child = NULL;
-    Symbol *sym;
 
     BEGIN {
 	if (!filename) {
 	    RAISE(XML_PROCESSING_ERROR, 
 		  newstr("File must be specified for runsql"));
 	}
-	filetext = readFile(filename);
+	if (!(cursor = takePrefetched(template_node))) {
+	    filetext = readFile(filename);
 
-	if (!filetext) {
-	    RAISE(FILEPATH_ERROR,
-		  newstr("Unable to find sql file: %s\n", filename->value));
-	}
-	sqltext = trimSqlText(filetext);
+	    if (!filetext) {
+		RAISE(FILEPATH_ERROR,
+		      newstr("Unable to find sql file: %s\n", 
+			     filename->value));
+	    }
+	    sqltext = trimSqlText(filetext);
     
-	conn = sqlConnect();
-	params = getExprAttribute(template_node, "params");
-	cursor = sqlExec(conn, sqltext, params);
+	    conn = sqlConnect();
+	    params = getExprAttribute(template_node, "params");
+	    if (sym && !params) {
+		cursor = execRunsqlBatch(conn, template_node, sqltext);
+	    }
+	    else {
+		cursor = sqlExec(conn, sqltext, params);
+	    }
+	}
 	
-	if (varname) {
-	    sym = symbolNew(varname->value);
+	if (sym) {
 	    setScopeForSymbol(sym);
 	    if (hashkey) {
 		cursorIndex(cursor, hashkey);
 	    } 
-	    symbolSet(varname->value, (Object *) cursor);
+	    if (groupkey) {
+		cursorGroup(cursor, groupkey);
+	    } 
+	    symSet(sym, (Object *) cursor);
 	}
 	else {
 	    child = iterate((Object *) cursor, NULL, 
@@ -640,14 +1602,14 @@ execRunsql(xmlNode *template_node, xmlNode *parent_node, int depth)
 		     filename->value, ex->text));
     }
     FINALLY {
-	if (!varname) {
+	if (!sym) {
 	    /* If a variable was defined, the cursor will be freed when
 	     * that variable goes out of scope, otherwise free it now. */
 	    objectFree((Object *) cursor, TRUE);
 	}
 	objectFree((Object *) filename, TRUE);
-	objectFree((Object *) varname, TRUE);
 	objectFree((Object *) hashkey, TRUE);
+	objectFree((Object *) groupkey, TRUE);
 	objectFree((Object *) sqltext, TRUE);
 	objectFree((Object *) filetext, TRUE);
 	objectFree((Object *) params, TRUE);
@@ -657,17 +1619,36 @@ execRunsql(xmlNode *template_node, xmlNode *parent_node, int depth)
     return child;
 }
 
+/* Return the rows from collection, which must be a cursor grouped
+ * using the group attribute of skit:runsql, that match key.
+ */
+static Object *
+groupForKey(Object *collection, Object *key)
+{
+    collection = dereference(collection);
+    if (collection->type != OBJ_CURSOR) {
+	RAISE(XML_PROCESSING_ERROR, 
+	      newstr("foreach key may only be used for cursors, not %s",
+		     objTypeName(collection)));
+    }
+    if (!(key = dereference(key))) {
+	return NULL;
+    }
+    return (Object *) cursorGroupGet((Cursor *) collection, key);
+}
+
 static xmlNode *
 execForeach(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *volatile fromname = nodeAttribute(template_node, "from");
-    String *volatile filter = nodeAttribute(template_node, "filter");
+    Symbol *volatile fromsym = nodeSymbol(template_node, "from");
+    Object *volatile key = NULL;
     Object *collection;
+    Object *rows;
     xmlNode *child = NULL;
 
     BEGIN {
-	if (fromname) {
-	    collection = symbolGetValue(fromname->value);
+	if (fromsym) {
+	    collection = symGet(fromsym);
 	}
 	else {
 	    if (!hasExpr(template_node, &collection)) {
@@ -680,21 +1661,27 @@ execForeach(xmlNode *template_node, xmlNode *parent_node, int depth)
 	    if (!isCollection(collection)) {
 		    RAISE(XML_PROCESSING_ERROR, 
 			  newstr("from variable %s does not contain a "
-				 "collection",  fromname->value));
+				 "collection",  fromsym? fromsym->name: "expr"));
+	    }
+	    rows = collection;
+	    if (hasExprAttribute(template_node, (Object **) &key, "key")) {
+		/* Iterate over only those rows matching key. */
+		rows = groupForKey(collection, key);
+	    }
+	    if (rows) {
+		child = iterate(rows, "filter", template_node, 
+				parent_node, depth);
 	    }
-	    child = iterate(collection, filter, template_node, 
-			    parent_node, depth);
 	}
     }
     EXCEPTION(ex);
     FINALLY {
-	if (!fromname) {
+	if (!fromsym) {
 	    /* Collection was determined from an expression, so it
 	     * must be freed. */
 	    objectFree(collection, TRUE);
 	}
-	objectFree((Object *) fromname, TRUE);
-	objectFree((Object *) filter, TRUE);
+	objectFree(key, TRUE);
     }
     END;
     
@@ -711,24 +1698,21 @@ execKids(xmlNode *template_node, xmlNode *parent_node, int depth)
 static xmlNode *
 execIf(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *volatile expr = nodeAttribute(template_node, "test");
-    Object *expr_result = NULL;
+    Object *volatile expr_result = NULL;
     xmlNode *result = NULL;
+
+    if (!hasExprAttribute(template_node, (Object **) &expr_result, "test")) {
+	RAISE(XML_PROCESSING_ERROR, 
+	      newstr("no \"test\" attribute provided for skit:if"));
+    }
     BEGIN {
-	if (expr) {
-	    if (expr_result = evalSexp(expr->value)) {
-		result = processChildren(template_node, parent_node, depth + 1);
-	    }
-	}
-	else {
-	    RAISE(XML_PROCESSING_ERROR, 
-		  newstr("no \"test\" attribute provided for skit:if"));
+	if (expr_result) {
+	    result = processChildren(template_node, parent_node, depth + 1);
 	}
     }
     EXCEPTION(ex);
     FINALLY {
 	objectFree((Object *) expr_result, TRUE);
-	objectFree((Object *) expr, TRUE);
     }
     END;
     return result;
@@ -753,26 +1737,17 @@ execLet(xmlNode *template_node, xmlNode *parent_node, int depth)
 static xmlNode *
 execVar(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *name = nodeAttribute(template_node, "name");
-    Symbol *sym;
+    Symbol *sym = nodeSymbol(template_node, "name");
     UNUSED(parent_node);
     UNUSED(depth);
 
-    if (!name) {
+    if (!sym) {
 	RAISE(XML_PROCESSING_ERROR, 
 	      newstr("Name must be specified for var"));
     }
 
-    sym = symbolGet(name->value);
-    
-    if (sym) {
-	objectFree(sym->svalue, TRUE);
-    }
-    else {
-	sym = symbolNew(name->value);
-    }
+    objectFree(sym->svalue, TRUE);
     setScopeForSymbol(sym);
-    objectFree((Object *) name, TRUE);
     sym->svalue = getExpr(template_node);
     return NULL;
 }
@@ -800,68 +1775,39 @@ execException(xmlNode *template_node, xmlNode *parent_node, int depth)
 static xmlNode *
 execDeclareFunction(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *name = nodeAttribute(template_node, "name");
-    Node *node = nodeNew(template_node);
-    Symbol *name_sym;
+    Symbol *name_sym = nodeSymbol(template_node, "name");
     UNUSED(parent_node);
     UNUSED(depth);
 
-    if (!name) {
+    if (!name_sym) {
 	RAISE(XML_PROCESSING_ERROR, 
 	      newstr("name attribute must be provided for function"));
     }
     
-    name_sym = symbolNew(name->value);
     objectFree(name_sym->svalue, TRUE);
-    name_sym->svalue = (Object *) node;
-    objectFree((Object *) name, TRUE);
+    name_sym->svalue = (Object *) nodeNew(template_node);
     return NULL;
 }
 
 static void
 getParam(xmlNode *template_node, xmlNode *cur_node)
 {
-    String *volatile name = nodeAttribute(cur_node, "name");
-    String *volatile dflt = NULL;
-    String *volatile expr = NULL;
+    Symbol *sym = nodeSymbol(cur_node, "name");
     Object *value = NULL;
-    Symbol *sym;
 
-    if (!name) {
+    if (!sym) {
 	RAISE(XML_PROCESSING_ERROR, 
 	      newstr("name attribute must be provided for parameter"));
     }
 
-    BEGIN {
-	if (expr = nodeAttribute(template_node, name->value)) {
-	    value = evalSexp(expr->value);
-	    //dbgSexp(value);
-	}
-	else {
-	    if (dflt = nodeAttribute(cur_node, "default")) {
-		value = evalSexp(dflt->value);
-	    }
-	    else {
-		RAISE(XML_PROCESSING_ERROR, 
-		      newstr("mandatory parameter %s not provided", 
-			     name->value));
-	    }
-	}
-	sym = symbolGet(name->value);
-    
-	if (!sym) {
-	    sym = symbolNew(name->value);
+    if (!hasExprAttribute(template_node, &value, sym->name)) {
+	if (!hasExprAttribute(cur_node, &value, "default")) {
+	    RAISE(XML_PROCESSING_ERROR, 
+		  newstr("mandatory parameter %s not provided", sym->name));
 	}
-	setScopeForSymbol(sym);
-	sym->svalue = value;
-    }
-    EXCEPTION(ex);
-    FINALLY {
-	objectFree((Object *) name, TRUE);
-	objectFree((Object *) dflt, TRUE);
-	objectFree((Object *) expr, TRUE);
     }
-    END;
+    setScopeForSymbol(sym);
+    sym->svalue = value;
 }
 
 static xmlNode *
@@ -892,25 +1838,20 @@ handleFunctionParams(xmlNode *template_node, xmlNode *function_node)
 static xmlNode *
 execExecuteFunction(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
-    String *name = nodeAttribute(template_node, "name");
+    Symbol *name_sym = nodeSymbol(template_node, "name");
     Node *node;
-    Symbol *name_sym;
     xmlNode *function_start;
     xmlNode *result = NULL;
 
-    if (!name) {
+    if (!name_sym) {
 	RAISE(XML_PROCESSING_ERROR, 
 	      newstr("name attribute must be provided for function call"));
     }
     
-    name_sym = symbolGet(name->value);
-    if (!name_sym) {
-	char *errstr = newstr("No such function: %s", name->value);
-	objectFree((Object *) name, TRUE);
-	RAISE(XML_PROCESSING_ERROR, errstr);
+    if (!(node = (Node *) name_sym->svalue)) {
+	RAISE(XML_PROCESSING_ERROR, 
+	      newstr("No such function: %s", name_sym->name));
     }
-    node = (Node *) name_sym->svalue;
-    objectFree((Object *) name, TRUE);
 
     newSymbolScope();
     BEGIN {
@@ -936,14 +1877,12 @@ execXSLproc(xmlNode *template_node, xmlNode *parent_node, int depth)
 	nodeAttribute(template_node, "stylesheet");
     String *volatile input = nodeAttribute(template_node, "input");
     String *volatile debug = nodeAttribute(template_node, "debug");
-    Document *volatile stylesheet = NULL;
+    Document *stylesheet = NULL;
     Document *volatile source_doc = NULL;
     Document *result_doc = NULL;
     boolean debug_before = FALSE;
     boolean debug_after = FALSE;
     Object *debug_value;
-    xmlNode *scratch;
-    xmlNode *result;
     xmlNode *root_node;
     UNUSED(parent_node);
 
@@ -977,7 +1916,7 @@ execXSLproc(xmlNode *template_node, xmlNode *parent_node, int depth)
 		  newstr("stylesheet attribute must be provided for xslproc"));
 	}
 
-	stylesheet = findDoc(stylesheet_name);
+	stylesheet = findStylesheet(stylesheet_name);
 
 	if (input && (streq(input->value, "pop"))) {
 	    source_doc = docStackPop();
@@ -1008,21 +1947,16 @@ execXSLproc(xmlNode *template_node, xmlNode *parent_node, int depth)
     FINALLY {
 	objectFree((Object *) debug, TRUE);
 	objectFree((Object *) source_doc, TRUE);
-	objectFree((Object *) stylesheet, TRUE);
 	objectFree((Object *) stylesheet_name, TRUE);
 	objectFree((Object *) input, TRUE);
     }
     END;
 
-    scratch = xmlDocGetRootElement(result_doc->doc);
-    /* The following causes a small memory leak.  I am assuming for now
-     * that the problem arises from libxml issues with namespaces but
-     * there is not much evidence for this. */
-    result = xmlCopyNode(scratch, 1);  // Adding this seems to make it
-				       // safe.  WTF?
-    //xmlUnlinkNode(result);           // This should be enough but is not!
-    objectFree((Object *) result_doc, TRUE);
-    return result;
+    /* As for skit:tsort, the root of the result is returned still
+     * within result_doc, which can be retrieved using docForNode().  If
+     * the root is added to another tree, adoptRoot() will free
+     * result_doc. */
+    return xmlDocGetRootElement(result_doc->doc);
 }
 
 static void
@@ -1143,6 +2077,7 @@ execTsort(xmlNode *template_node, xmlNode *parent_node, int depth)
     Document *volatile source_doc = NULL;
     Document *volatile result_doc = NULL;
     Vector *volatile sorted = NULL;
+    Arena *volatile arena = NULL;
     xmlNode *root = NULL;
     Symbol *fb_proc = symbolNew("fallback_processor");
     Symbol *ddl_proc = symbolNew("ddl_processor");
@@ -1155,6 +2090,10 @@ execTsort(xmlNode *template_node, xmlNode *parent_node, int depth)
 	if (input && (streq(input->value, "pop"))) {
 	    source_doc = docStackPop();
 	}
+	/* The dependency graph built by tsort lives only until the
+	 * result document has been created, so its nodes and
+	 * dependencies are allocated from an arena. */
+	arena = arenaBegin();
 	sorted = tsort(source_doc);
 	result_doc = docFromVector(parent_node, sorted);
 	root = xmlDocGetRootElement(result_doc->doc);
@@ -1162,6 +2101,9 @@ execTsort(xmlNode *template_node, xmlNode *parent_node, int depth)
     EXCEPTION(ex);
     FINALLY {
 	objectFree((Object *) sorted, TRUE);
+	if (arena) {
+	    arenaEnd(arena);
+	}
 	objectFree((Object *) input, TRUE);
 	objectFree((Object *) source_doc, TRUE);
     }
@@ -1620,8 +2562,12 @@ writeScatterFile(String *path, String *name, xmlNode *node,
 		add_footer(new_root, footer_node);
 	    }
 	    if (!checkonly) {
-		scatterfile = fopen(fullpath->value, "w");
-		documentPrintXML(scatterfile, new_doc);
+		if (!(scatterfile = fopen(fullpath->value, "w"))) {
+		    RAISE(FILEPATH_ERROR,
+			  newstr("Cannot write scatter file \"%s\"", 
+				 fullpath->value));
+		}
+		documentPrintXML(scatterfile, new_doc, FALSE);
 		fclose(scatterfile);
 	    }
 	}
@@ -2034,6 +2980,7 @@ execProcess(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
     String *volatile input = nodeAttribute(template_node, "input");
     Document *volatile source_doc = NULL;
+    Cons *volatile mark = compiled_nodes;
     xmlNode *result = NULL;
     xmlNode *root_node;
     xmlNode *oldfiles;
@@ -2063,6 +3010,9 @@ execProcess(xmlNode *template_node, xmlNode *parent_node, int depth)
     }
     EXCEPTION(ex);
     FINALLY {
+	/* Nodes from source_doc may have cached expressions, which must
+	 * be freed before the document is. */
+	freeExprCaches(mark);
 	objectFree((Object *) source_doc, TRUE);
 	objectFree((Object *) input, TRUE);
     }
@@ -2115,17 +3065,52 @@ freeSkitProcessors()
     }
 }
 
+/* Identify those processors that add their children's output directly
+ * to parent_node, and so may have that output streamed.  All others
+ * are streaming barriers.  */
+static boolean
+streamsThrough(xmlFn *fn)
+{
+    static xmlFn *transparent[] = {
+	&attributeFn, &textFn, &execFn, &execResult, &ignoreFn,
+	&stylesheetFn, &execKids, &execRunsql, &execForeach, &execIf,
+	&execLet, &execVar, &execException, &execDeclareFunction,
+	&execExecuteFunction, NULL};
+    int i;
+
+    for (i = 0; transparent[i]; i++) {
+	if (fn == transparent[i]) {
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
 static xmlNode *
 execXmlNodeFn(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
     String *name = stringNew((char *) template_node->name);
     FnReference *ref;
     xmlFn *fn;
+    StreamFrame *volatile frame = NULL;
+    xmlNode *volatile result = NULL;
+
     initSkitProcessors();
     if (ref = (FnReference *) hashGet(skit_processors, (Object *) name)) {
 	fn = (xmlFn *) ref->fn;
 	objectFree((Object *) name, TRUE);
-	return (*fn)(template_node, parent_node, depth);
+	if (!streamsThrough(fn)) {
+	    frame = streamPush(NULL, NULL, parent_node);
+	}
+	BEGIN {
+	    result = (*fn)(template_node, parent_node, depth);
+	}
+	EXCEPTION(ex);
+	FINALLY {
+	    streamPop(frame);
+	}
+	END;
+	return result;
     }
     else {
 	objectFree((Object *) name, TRUE);
@@ -2139,6 +3124,7 @@ static xmlNode *
 processNode(xmlNode *template_node, xmlNode *parent_node, int depth)
 {
     xmlNode *volatile this = NULL;
+    StreamFrame *volatile frame = NULL;
     xmlNs *ns;
 
     assert(template_node, "template_node is NULL in processNode");
@@ -2160,14 +3146,18 @@ processNode(xmlNode *template_node, xmlNode *parent_node, int depth)
     }
     else {
 	this = xmlCopyNode(template_node, 2);
+	frame = streamPush(this, template_node, parent_node);
 	BEGIN {
 	    processChildren(template_node, this, depth + 1);
+	    this = streamClose(frame, this);
 	}
 	EXCEPTION(ex) {
+	    streamPop(frame);
 	    if (this) xmlFreeNode(this);
 	    RAISE();
 	}
 	END;
+	streamPop(frame);
     }
 
     return this;
@@ -2299,7 +3289,10 @@ processRemaining(xmlNode *remaining, xmlNode *parent_node, int depth)
 	    END;
 	    if (child) {
 		if (parent_node) {
-		    xmlAddChild(parent_node, child);
+		    child = adoptRoot(child);
+		    if (!streamAdd(parent_node, child, cur_node)) {
+			xmlAddChild(parent_node, child);
+		    }
 		}
 		else {
 		    while (next_node && (next_node->type == XML_TEXT_NODE)) {
@@ -2331,19 +3324,26 @@ Document *
 processTemplate(Document *template)
 {
     xmlNode *root;
-    xmlDocPtr doc; 
-    xmlNode *newroot;
+    xmlNode *volatile newroot = NULL;
     Document *result = NULL;
 
     cur_template = template;
     root = xmlDocGetRootElement(template->doc);
-    if (newroot = processNode(root, NULL, 1)) {
-	doc = newroot->doc;
-	if (!doc) {
-	    doc = xmlNewDoc((xmlChar *) "1.0");
-	    xmlDocSetRootElement(doc, newroot);
-	}
-	result = documentNew(doc, NULL);
+    caching_exprs = TRUE;
+    BEGIN {
+	newroot = processNode(root, NULL, 1);
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	freeExprCaches(NULL);
+	freePrefetched();
+	caching_exprs = FALSE;
+    }
+    END;
+    if (newroot && !(result = docForNode(newroot))) {
+	/* The node belongs to a document that has no Document
+	 * object. */
+	result = documentNew(newroot->doc, NULL);
     }
     return result;
 }
@@ -200,7 +200,7 @@
 	<!-- Ditto for column privs.  -->
       </xsl:when>
       <xsl:when 
-	  test="//cluster/role[@name=$grantor]/privilege[@priv='superuser']">
+	  test="key('cluster_role', $grantor)/privilege[@priv='superuser']">
 	<!-- No dependency if the role is granted from a superuser -->
       </xsl:when>
       <xsl:otherwise>  
@@ -20,7 +20,7 @@
     <!-- If the owner of the operator family is a superuser, this gets
 	 set to "superuser". -->
     <xsl:variable name="owner_is_superuser"
-		  select="//cluster/role[@name=$owner]/privilege[@priv='superuser']/@priv"/>
+		  select="key('cluster_role', $owner)/privilege[@priv='superuser']/@priv"/>
     <dbobject type="operator_family" fqn="{$operator_family_fqn}"
 	      name="{@name}" qname="{skit:dbquote(@schema,@name)}"
 	      parent="{concat(name(..), '.', $parent_core)}"
@@ -32,12 +32,12 @@
 	<xsl:when test="$owner_is_superuser='superuser'">
 	  <xsl:if test="@owner">
 	    <context type="owner" value="{@owner}" 
-		     default="{//cluster/@username}"/>	
+		     default="{$cluster_username}"/>	
 	  </xsl:if>
 	</xsl:when>
 	<xsl:otherwise>
-	    <context type="owner" value="{//cluster/@username}" 
-		     default="{//cluster/@username}"/>	
+	    <context type="owner" value="{$cluster_username}" 
+		     default="{$cluster_username}"/>	
 	</xsl:otherwise>
       </xsl:choose>
       <dependencies>
@@ -63,10 +63,10 @@
 	     superuser, maybe we don't have to. --> 
 	<dependency-set priority="2"
 	    fallback="{concat('privilege.role.', 
-		              //cluster/@username, '.superuser')}"
+		              $cluster_username, '.superuser')}"
 	    parent="ancestor::dbobject[database]">
 	  <dependency fqn="{concat('privilege.role.', 
-		                   //cluster/@username, '.superuser')}"/>
+		                   $cluster_username, '.superuser')}"/>
 	  <dependency fqn="{concat('privilege.role.', 
 			           $owner, '.superuser')}"/>
 	</dependency-set>
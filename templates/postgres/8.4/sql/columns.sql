@@ -1,16 +1,19 @@
--- Columns for a table, including details of inherited columns
+-- Columns for all tables and views, including details of inherited
+-- columns.  This is run once for the database and grouped by
+-- relation_oid.
 
 with recursive inheritence_set(
-    reloid, tablename, 
+    relation_oid, reloid, tablename, 
     schemaname, seq_no) as
 (
-  select t.oid, t.relname, s.nspname, 0
+  select t.oid, t.oid, t.relname, s.nspname, 0
     from pg_catalog.pg_class t
    inner join pg_catalog.pg_namespace s
       on s.oid = t.relnamespace
-   where t.oid = :1
+   where t.relkind in ('r', 'v', 'm', 'f')
+     and s.nspname not in ('pg_catalog', 'pg_toast', 'information_schema')
   union all
-  select t.oid, t.relname, s.nspname, i.inhseqno
+  select iset.relation_oid, t.oid, t.relname, s.nspname, i.inhseqno
     from inheritence_set iset
    inner join pg_catalog.pg_inherits i
       on i.inhrelid = iset.reloid
@@ -19,7 +22,8 @@ with recursive inheritence_set(
    inner join pg_catalog.pg_namespace s
       on s.oid = t.relnamespace
 )
-select a.attnum as colnum,
+select iset.relation_oid,
+       a.attnum as colnum,
        a.attname as name,
        iset.tablename, 
        iset.schemaname,
@@ -63,4 +67,4 @@ select a.attnum as colnum,
     on (    t2.oid = t.typelem
         and t.typlen < 0)
  where a.attnum > 0
- order by iset.seq_no, a.attnum;
+ order by iset.relation_oid, iset.seq_no, a.attnum;
@@ -1,5 +1,6 @@
--- List all non pk and uk indexes
-select c.oid as oid,
+-- List all non pk and uk indexes for all relations, grouped by table_oid
+select i.indrelid as table_oid,
+       c.oid as oid,
        c.relname as name,
        n.nspname as schema,
        r.rolname as owner,
@@ -47,7 +48,6 @@ inner join pg_catalog.pg_database dat
   on dat.datname = current_database()
 inner join pg_catalog.pg_tablespace td
   on td.oid = dat.dattablespace
-where  i.indrelid = :1
---where  i.indrelid = 16552
+where  n.nspname not in ('pg_catalog', 'pg_toast', 'information_schema')
 and    d.objid is null                  -- eliminate indexes for constraints
-order by n.nspname, c.relname;
\ No newline at end of file
+order by i.indrelid, n.nspname, c.relname;
\ No newline at end of file
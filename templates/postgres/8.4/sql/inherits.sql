@@ -1,6 +1,7 @@
--- List inheritence
+-- List inheritence for all tables, grouped by table_oid
 
-select c.relname as inherit_table,
+select i.inhrelid as table_oid,
+       c.relname as inherit_table,
        n.nspname as inherit_schema,
        i.inhseqno as inherit_order
 from   pg_catalog.pg_inherits i
@@ -8,5 +9,4 @@ from   pg_catalog.pg_inherits i
         on c.oid = i.inhparent
     inner join pg_catalog.pg_namespace n
         on n.oid = c.relnamespace
-where  i.inhrelid = :1
-order by i.inhseqno;
+order by i.inhrelid, i.inhseqno;
@@ -1,5 +1,7 @@
--- List all pk, uk and fk constraints
-select c.oid as oid,
+-- List all pk, uk and fk constraints for all tables, grouped by
+-- table_oid
+select c.conrelid as table_oid,
+       c.oid as oid,
        c.conname as name,
        n.nspname as schema,
        case c.contype when 'p' then 'primary key' 
@@ -70,6 +72,6 @@ left outer join (pg_catalog.pg_depend dr    -- dependency of fk back to index
   and idxclass.relkind = 'i'
   and idxdep.classid = cclass.oid
   and idxdep.refclassid = ccons.oid
-where   c.conrelid = :1
---where c.conrelid in (88410)
-order by c.contype, n.nspname, c.conname;
+where   c.conrelid != 0
+and     n.nspname not in ('pg_catalog', 'pg_toast', 'information_schema')
+order by c.conrelid, c.contype, n.nspname, c.conname;
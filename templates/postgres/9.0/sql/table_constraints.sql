@@ -1,3 +1,4 @@
+-- List all constraints for all tables, grouped by table_oid
 with my_constraints as (
   select c.oid,
        c.conname as name,
@@ -35,8 +36,8 @@ with my_constraints as (
        inner join pg_catalog.pg_namespace nr    -- schema of ref table for fk
            on nr.oid = cr.relnamespace
     ) on cr.oid = c.confrelid
-   -- where c.conrelid = 16538
-   where c.conrelid = :1
+   where c.conrelid != 0
+     and n.nspname not in ('pg_catalog', 'pg_toast', 'information_schema')
      and c.contype != 't'
 ),
   indexinfo as (
@@ -113,7 +114,7 @@ with my_constraints as (
     from coldetails
    group by oid
 )
-select c.oid, c.name, c.schema,
+select c.table_oid, c.oid, c.name, c.schema,
        c.constraint_type, c.deferrable, c.deferred,
        c.columns, c.refcolumns, i.options,
        i.tablespace, i.access_method, i.owner,
@@ -135,4 +136,4 @@ select c.oid, c.name, c.schema,
     on i.oid = c.oid
   left outer join colstrs cs
     on cs.oid = c.oid
- order by c.oid, c.schema, c.name;
\ No newline at end of file
+ order by c.table_oid, c.oid, c.schema, c.name;
\ No newline at end of file
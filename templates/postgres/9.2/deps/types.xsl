@@ -71,7 +71,7 @@
 		parent="{concat(name(..), '.', $parent_core)}"
 		follow="{concat('type.', $parent_core, '.', @name)}">
 	<context type="owner" value="{@owner}" 
-		 default="{//cluster/@username}"/>
+		 default="{$cluster_username}"/>
 	<dependencies>
 	  <dependency fqn="{concat(name(..), '.', $parent_core)}"/>
 	  <dependency fqn="{concat('role.', @owner)}"/>
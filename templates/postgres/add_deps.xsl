@@ -10,6 +10,13 @@
   <xsl:output method="xml" indent="yes"/>
   <xsl:strip-space elements="*"/>
 
+  <!-- The cluster username and cluster roles are needed for many
+       dbobjects.  Looking them up here, rather than with a search of
+       the whole document for each dbobject, keeps the cost of this
+       stylesheet linear in the size of the dump. -->
+  <xsl:variable name="cluster_username" select="//cluster/@username"/>
+  <xsl:key name="cluster_role" match="cluster/role" use="@name"/>
+
   <!-- This stylesheet adds dependency definitions to dbobjects unless
        they appear to already exist. -->
 
@@ -224,7 +231,7 @@
 
       <xsl:if test="$owner and $do_context = 'yes'">
 	<context type="owner" value="{$owner}" 
-		 default="{//cluster/@username}"/>	
+		 default="{$cluster_username}"/>	
       </xsl:if>
 
       <dependencies>
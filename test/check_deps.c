@@ -1824,6 +1824,159 @@ START_TEST(cyclic_exception)
 }
 END_TEST
 
+/* Return the build types and fqns of the nodes of the document at
+ * path, in the order that tsort gives for the current build and drop
+ * settings.
+ */
+static char *
+tsortedNames(char *path)
+{
+    Document *volatile doc = getDoc(path);
+    Vector *volatile results = NULL;
+    char *volatile names = newstr("");
+    char *tmp;
+    DagNode *node;
+    int i;
+
+    BEGIN {
+	results = tsort(doc);
+	EACH(results, i) {
+	    node = (DagNode *) ELEM(results, i);
+	    tmp = newstr("%s%s.%s\n", names, 
+			 nameForBuildType(node->build_type), 
+			 node->fqn->value);
+	    skfree(names);
+	    names = tmp;
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree((Object *) results, TRUE);
+	objectFree((Object *) doc, TRUE);
+    }
+    END;
+    return names;
+}
+
+static void
+checkTsortedNames(char *path, char *expected)
+{
+    char *names = tsortedNames(path);
+    if (!streq(names, expected)) {
+	fprintf(stderr, "EXPECTED:\n%s\nGOT:\n%s\n", expected, names);
+	fail("Order of nodes from %s has changed", path);
+    }
+    skfree(names);
+}
+
+/* Check that resolving dependencies one strongly connected component
+ * at a time gives the same generate order as resolving them from each
+ * node in document order, as the resolver used to.  The expected
+ * orders were produced by the resolver before components were
+ * introduced.
+ */
+START_TEST(component_order)
+{
+    initTemplatePath(".");
+    eval("(setq dbver (version '8.4'))");
+
+    eval("(setq build t)");
+    eval("(setq drop t)");
+    checkTsortedNames("test/data/depset_simple.xml",
+		      "drop.privilege.role.regress.superuser\n"
+		      "drop.function.regressdb.public.seg2int(public.seg)\n"
+		      "drop.language.regressdb.plpgsql\n"
+		      "drop.function.regressdb.public.seg_cmp(public.seg,public.seg)\n"
+		      "drop.type.regressdb.public.seg\n"
+		      "drop.function.regressdb.public.seg_out(public.seg)\n"
+		      "drop.function.regressdb.public.seg_in(pg_catalog.cstring)\n"
+		      "drop.privilege.role.bark.superuser\n"
+		      "drop.privilege.role.bark.inherit\n"
+		      "drop.privilege.role.bark.createrole\n"
+		      "drop.privilege.role.bark.createdb\n"
+		      "drop.role.bark\n"
+		      "drop.schema.regressdb.public\n"
+		      "drop.database.regressdb\n"
+		      "drop.dbincluster.regressdb\n"
+		      "drop.role.regress\n"
+		      "drop.cluster\n"
+		      "build.cluster\n"
+		      "build.role.regress\n"
+		      "build.privilege.role.regress.superuser\n"
+		      "build.dbincluster.regressdb\n"
+		      "build.database.regressdb\n"
+		      "build.role.bark\n"
+		      "build.privilege.role.bark.superuser\n"
+		      "build.privilege.role.bark.inherit\n"
+		      "build.privilege.role.bark.createrole\n"
+		      "build.privilege.role.bark.createdb\n"
+		      "build.language.regressdb.plpgsql\n"
+		      "build.schema.regressdb.public\n"
+		      "build.function.regressdb.public.seg_in(pg_catalog.cstring)\n"
+		      "build.function.regressdb.public.seg_out(public.seg)\n"
+		      "build.type.regressdb.public.seg\n"
+		      "build.function.regressdb.public.seg2int(public.seg)\n"
+		      "build.function.regressdb.public.seg_cmp(public.seg,public.seg)\n");
+
+    /* This contains a cycle that must be broken by a cycle breaker. */
+    checkTsortedNames("test/data/gensource2.xml",
+		      "drop.viewbase.skittest.public.v3\n"
+		      "drop.privilege.role.marc.superuser\n"
+		      "drop.privilege.role.marc.inherit\n"
+		      "drop.privilege.role.marc.createrole\n"
+		      "drop.privilege.role.marc.createdb\n"
+		      "drop.view.skittest.public.v1\n"
+		      "drop.view.skittest.public.v2\n"
+		      "drop.view.skittest.public.v3\n"
+		      "drop.role.marc\n"
+		      "drop.privilege.role.postgres.superuser\n"
+		      "drop.privilege.role.postgres.inherit\n"
+		      "drop.privilege.role.postgres.createrole\n"
+		      "drop.privilege.role.postgres.createdb\n"
+		      "drop.grant.schema.skittest.public.usage:public:regress\n"
+		      "drop.schema.skittest.public\n"
+		      "drop.role.postgres\n"
+		      "drop.privilege.role.regress.superuser\n"
+		      "drop.grant.database.skittest.temporary:public\n"
+		      "drop.grant.database.skittest.connect:public\n"
+		      "drop.grant.database.skittest.create\n"
+		      "drop.grant.database.skittest.temporary\n"
+		      "drop.grant.database.skittest.connect\n"
+		      "drop.role.regress\n"
+		      "drop.database.skittest\n"
+		      "drop.dbincluster.skittest\n"
+		      "drop.cluster\n"
+		      "build.cluster\n"
+		      "build.dbincluster.skittest\n"
+		      "build.database.skittest\n"
+		      "build.role.marc\n"
+		      "build.privilege.role.marc.superuser\n"
+		      "build.privilege.role.marc.inherit\n"
+		      "build.privilege.role.marc.createrole\n"
+		      "build.privilege.role.marc.createdb\n"
+		      "build.role.postgres\n"
+		      "build.privilege.role.postgres.superuser\n"
+		      "build.privilege.role.postgres.inherit\n"
+		      "build.privilege.role.postgres.createrole\n"
+		      "build.privilege.role.postgres.createdb\n"
+		      "build.role.regress\n"
+		      "build.privilege.role.regress.superuser\n"
+		      "build.grant.database.skittest.temporary:public\n"
+		      "build.grant.database.skittest.connect:public\n"
+		      "build.grant.database.skittest.create\n"
+		      "build.grant.database.skittest.temporary\n"
+		      "build.grant.database.skittest.connect\n"
+		      "build.schema.skittest.public\n"
+		      "build.grant.schema.skittest.public.usage:public:regress\n"
+		      "build.viewbase.skittest.public.v3\n"
+		      "build.view.skittest.public.v2\n"
+		      "build.view.skittest.public.v1\n"
+		      "build.view.skittest.public.v3\n");
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 START_TEST(depset_diff)
 {
     Document *volatile doc = NULL;
@@ -1999,6 +2152,348 @@ END_TEST
 
 
 
+static void
+checkDiff(Document *diffs, char *fqn, char *expected)
+{
+    char *expr = newstr("string(//dbobject[@fqn='%s']/@diff)", fqn);
+    xmlXPathObject *obj = xpathEval(diffs, NULL, expr);
+    char *diff = (char *) obj->stringval;
+
+    if (!streq(diff, expected)) {
+	fail("Expected diff=\"%s\" for %s, got \"%s\"", 
+	     expected, fqn, diff);
+    }
+    xmlXPathFreeObject(obj);
+    skfree(expr);
+}
+
+/* processDiffs frees each source dbobject as soon as its diff has been
+ * built, so matched children are freed while their parents are still
+ * being walked, dropped objects are freed by recordDroppedObj, and
+ * promoteRebuilds runs only once every source dbobject has gone.
+ * Check that the result is still complete.  Run this under a memory
+ * checker to catch any reference to a freed source node. */
+START_TEST(diff_release)
+{
+    Document *volatile diffs = NULL;
+
+    initTemplatePath(".");
+    diffs = creatediffs("test/data/diffs_2_a.xml",
+			"test/data/diffs_2_b.xml");
+
+    BEGIN {
+	checkDiff(diffs, "cluster", "diffkids");
+	checkDiff(diffs, "role.marc", "none");
+	checkDiff(diffs, "database.x", "diffkids");
+	checkDiff(diffs, "schema.x.public", "diffkids");
+	checkDiff(diffs, "grant.schema.x.public.usage:public", "none");
+	checkDiff(diffs, "type.x.public.t", "rebuild");
+
+	/* Promoted by promoteRebuilds, after table.x.public.x and its
+	 * column have been freed from both sources. */
+	checkDiff(diffs, "table.x.public.x", "diffkids");
+	checkDiff(diffs, "column.x.public.x.y", "rebuild");
+	checkDiff(diffs, "grant.table.x.public.x.select:marc", "none");
+
+	checkDiff(diffs, "schema.x.added", "new");
+	checkDiff(diffs, "table.x.added.n", "new");
+	checkDiff(diffs, "column.x.added.n.a", "new");
+
+	/* Dropped objects, recorded by recordDroppedObj. */
+	checkDiff(diffs, "schema.x.gone", "gone");
+	checkDiff(diffs, "table.x.gone.g", "gone");
+	checkDiff(diffs, "column.x.gone.g.a", "gone");
+	checkDiff(diffs, "grant.table.x.gone.g.select:marc", "gone");
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    FINALLY {
+	objectFree((Object *) diffs, TRUE);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+static double
+countNodes(Document *diffs, char *expr)
+{
+    xmlXPathObject *obj = xpathEval(diffs, NULL, expr);
+    double result = obj->floatval;
+
+    xmlXPathFreeObject(obj);
+    return result;
+}
+
+/* Dbobjects whose fingerprints match are diffed without checking their
+ * rules, and their children are paired by position.  Diffing a
+ * document with itself must still give a complete result in which
+ * every dbobject is the same, and in which no fingerprints appear. */
+START_TEST(fingerprint_equal)
+{
+    Document *volatile diffs = NULL;
+
+    initTemplatePath(".");
+    diffs = creatediffs("test/data/diffs_2_a.xml",
+			"test/data/diffs_2_a.xml");
+
+    BEGIN {
+	fail_unless(countNodes(diffs, "count(//dbobject)") == 
+		    countNodes(diffs, "count(//dbobject[@diff='none'])"),
+		    "Expected all dbobjects to be the same");
+	fail_unless(countNodes(diffs, "count(//dbobject)") > 30,
+		    "Expected a complete diff result");
+	fail_unless(countNodes(diffs, "count(//@fingerprint)") == 0,
+		    "Fingerprints found in diff result");
+	checkDiff(diffs, "cluster", "none");
+	checkDiff(diffs, "table.x.gone.g", "none");
+	checkDiff(diffs, "column.x.gone.g.a", "none");
+	checkDiff(diffs, "grant.table.x.gone.g.select:marc", "none");
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    FINALLY {
+	objectFree((Object *) diffs, TRUE);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* A change to a leaf dbobject (type t) must be found, and reported
+ * through each of its ancestors, while its unchanged siblings are
+ * handled as the same. */
+START_TEST(fingerprint_leaf)
+{
+    Document *volatile diffs = NULL;
+
+    initTemplatePath(".");
+    diffs = creatediffs("test/data/diffs_1_a.xml",
+			"test/data/diffs_1_b.xml");
+
+    BEGIN {
+	checkDiff(diffs, "type.x.public.t", "rebuild");
+	checkDiff(diffs, "schema.x.public", "diffkids");
+	checkDiff(diffs, "database.x", "diffkids");
+	checkDiff(diffs, "cluster", "diffkids");
+	checkDiff(diffs, "role.marc", "none");
+	checkDiff(diffs, "privilege.role.marc.superuser", "none");
+	checkDiff(diffs, "grant.schema.x.public.usage:public", "none");
+	checkDiff(diffs, "grant.table.x.public.x.select:marc", "none");
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    FINALLY {
+	objectFree((Object *) diffs, TRUE);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* Changing or adding a child dbobject (a grant on table x, or type t2
+ * in schema public) leaves the contents of its parent unchanged, but
+ * must change the parent's fingerprint, so that the children are
+ * matched by key rather than paired by position. */
+START_TEST(fingerprint_child)
+{
+    Document *volatile diffs = NULL;
+
+    initTemplatePath(".");
+    diffs = creatediffs("test/data/diffs_1_a.xml",
+			"test/data/diffs_3_b.xml");
+
+    BEGIN {
+	checkDiff(diffs, "grant.table.x.public.x.select:marc", "diff");
+	checkDiff(diffs, "table.x.public.x", "diffkids");
+	checkDiff(diffs, "schema.x.public", "diffkids");
+	checkDiff(diffs, "type.x.public.t2", "new");
+	checkDiff(diffs, "grant.table.x.public.x.insert:marc", "none");
+	checkDiff(diffs, "column.x.public.x.y", "none");
+	checkDiff(diffs, "type.x.public.t", "none");
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    FINALLY {
+	objectFree((Object *) diffs, TRUE);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* Add deps to the document in path, and give every dbobject in it the
+ * same fingerprint, before pushing it onto the docstack. */
+static void
+pushWithFingerprints(char *path, char *fingerprint)
+{
+    Document *doc = getDoc(path);
+    xmlXPathObject *obj;
+    int i;
+
+    docStackPush(doc);
+    addDeps();
+    doc = docStackPop();
+    obj = xpathEval(doc, NULL, "//dbobject");
+    for (i = 0; i < obj->nodesetval->nodeNr; i++) {
+	(void) xmlSetProp(obj->nodesetval->nodeTab[i], 
+			  (xmlChar *) "fingerprint", (xmlChar *) fingerprint);
+    }
+    xmlXPathFreeObject(obj);
+    docStackPush(doc);
+}
+
+/* Fingerprints found in the input are not trusted. */
+START_TEST(fingerprint_input)
+{
+    Document *volatile diffs = NULL;
+    String *diffrules = stringNew("diffrules.xml");
+    xmlDocPtr docnode; 
+
+    initTemplatePath(".");
+    pushWithFingerprints("test/data/diffs_1_a.xml", "bogus");
+    pushWithFingerprints("test/data/diffs_1_b.xml", "bogus");
+    docnode = xmlNewDoc((xmlChar *) "1.0");
+    xmlDocSetRootElement(docnode, doDiff(diffrules, FALSE));
+    diffs = documentNew(docnode, NULL);
+    objectFree((Object *) diffrules, TRUE);
+
+    BEGIN {
+	checkDiff(diffs, "type.x.public.t", "rebuild");
+	checkDiff(diffs, "schema.x.public", "diffkids");
+	checkDiff(diffs, "role.marc", "none");
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    FINALLY {
+	objectFree((Object *) diffs, TRUE);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* Run add_deps over adddeps_source.xml as though it came from a
+ * server of the given version, returning the result as text. */
+static xmlChar *
+addDepsText(char *version)
+{
+    Document *volatile doc = getDoc("test/data/adddeps_source.xml");
+    xmlXPathObject *obj;
+    xmlChar *result = NULL;
+    int len;
+
+    BEGIN {
+	obj = xpathEval(doc, NULL, "//cluster");
+	(void) xmlSetProp(obj->nodesetval->nodeTab[0], 
+			  (xmlChar *) "version", (xmlChar *) version);
+	xmlXPathFreeObject(obj);
+	readDocDbver(doc);
+	docStackPush(doc);
+	doc = NULL;
+	addDeps();
+	doc = docStackPop();
+	if (doc && doc->doc) {
+	    xmlDocDumpFormatMemory(doc->doc, &result, &len, 1);
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	objectFree((Object *) doc, TRUE);
+    }
+    END;
+    return result;
+}
+
+/* Fail, showing the first differing line, unless the add_deps output
+ * for version matches the text in the file expected. */
+static void
+checkAddDeps(char *version, char *expected)
+{
+    String *filename = stringNew(expected);
+    String *volatile contents = NULL;
+    xmlChar *volatile output = NULL;
+    char *out;
+    char *exp;
+    int line = 1;
+
+    BEGIN {
+	contents = readFile(filename);
+	if (!contents) {
+	    fail("Cannot read %s", expected);
+	}
+	output = addDepsText(version);
+	if (!output) {
+	    fail("No add_deps output for %s", version);
+	}
+	out = (char *) output;
+	exp = contents->value;
+	while (*out && (*out == *exp)) {
+	    if (*out == '\n') {
+		line++;
+	    }
+	    out++;
+	    exp++;
+	}
+	if (*out || *exp) {
+	    fail("add_deps output for %s differs from %s at line %d", 
+		 version, expected, line);
+	}
+    }
+    EXCEPTION(ex);
+    FINALLY {
+	if (output) {
+	    xmlFree(output);
+	}
+	objectFree((Object *) contents, TRUE);
+	objectFree((Object *) filename, TRUE);
+    }
+    END;
+}
+
+/* The expected files were produced by the add_deps stylesheets as
+ * they were before their searches of the whole document for the
+ * cluster username and for roles were replaced by a variable and a
+ * key.  Between them, 8.4 and 9.2 use every stylesheet that was
+ * changed. */
+START_TEST(adddeps_unchanged)
+{
+    initTemplatePath(".");
+    BEGIN {
+	checkAddDeps("8.4.21", "test/data/adddeps_expected_8.4.xml");
+	checkAddDeps("9.2.4", "test/data/adddeps_expected_9.2.xml");
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 START_TEST(general_diffs)
 {
     Document *volatile diffs = NULL;
@@ -2072,8 +2567,15 @@ deps_suite(void)
     ADD_TEST(tc_core, cyclic_drop);
     ADD_TEST(tc_core, cyclic_both);
     ADD_TEST(tc_core, cyclic_exception);
+    ADD_TEST(tc_core, component_order);
     ADD_TEST(tc_core, depset_diff);
     ADD_TEST(tc_core, depdiffs_1);
+    ADD_TEST(tc_core, diff_release);
+    ADD_TEST(tc_core, fingerprint_equal);
+    ADD_TEST(tc_core, fingerprint_leaf);
+    ADD_TEST(tc_core, fingerprint_child);
+    ADD_TEST(tc_core, fingerprint_input);
+    ADD_TEST(tc_core, adddeps_unchanged);
     ADD_TEST(tc_core, general_diffs);
     // For debugging regression tests
     // ADD_TEST(tc_core, rt3);  /* Diff from regression_test_3 */
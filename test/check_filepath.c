@@ -79,6 +79,47 @@ START_TEST(find_x)
 }
 END_TEST
 
+START_TEST(find_versions)
+{
+    char *tmp;
+    char *result;
+    int i;
+
+    /* The second time around, results come from the path cache. */
+    for (i = 0; i < 2; i++) {
+	result = find_in_8_2("ver2");
+	fail_unless(streq("test/templates/postgres/8.1/ver2", result), 
+		    tmp = newstr("Filepath for ver2 is %s\n", result));
+	skfree(tmp);
+	skfree(result);
+
+	result = find_in_8_2("ver3");
+	fail_unless(streq("test/templates/postgres/8.2/ver3", result), 
+		    tmp = newstr("Filepath for ver3 is %s\n", result));
+	skfree(tmp);
+	skfree(result);
+
+	result = find_in_8_2("postgres/8.3/ver");
+	fail_unless(streq("test/templates/postgres/8.3/ver", result), 
+		    tmp = newstr("Filepath for postgres/8.3/ver is %s\n", 
+				 result));
+	skfree(tmp);
+	skfree(result);
+
+	result = find_in_8_2("8.?/ver3");
+	fail_unless(streq("test/templates/postgres/8.1/ver3", result), 
+		    tmp = newstr("Filepath for 8.?/ver3 is %s\n", result));
+	skfree(tmp);
+	skfree(result);
+
+	result = find_in_8_2("xyzzy");
+	fail_unless(result == NULL, "Filepath found for xyzzy\n");
+    }
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 
 Suite *
 filepaths_suite(void)
@@ -88,6 +129,7 @@ filepaths_suite(void)
     /* Core test case */
     TCase *tc_core = tcase_create("Filepaths");
     ADD_TEST(tc_core, find_x);
+    ADD_TEST(tc_core, find_versions);
     suite_add_tcase(s, tc_core);
 
     return s;
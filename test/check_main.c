@@ -339,6 +339,7 @@ main(int argc, char *argv[])
 	ADD_SUITE(relaxng);
 	ADD_SUITE(tsort);
 	ADD_SUITE(deps);
+	ADD_SUITE(sql);
     }
 
     if (!reporting_only) {
@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "../src/skit.h"
 #include "../src/exceptions.h"
@@ -773,6 +774,39 @@ START_TEST(symbol_scope3)
 }
 END_TEST
 
+START_TEST(symbol_scope4)
+{
+    Symbol *wibble;
+
+    wibble = symbolNew("wibble");
+    symbolSet("wibble", (Object *) stringNew("outer"));
+
+    newSymbolScope();
+    setScopeForSymbol(wibble);
+    symbolSet("wibble", (Object *) stringNew("middle"));
+
+    newSymbolScope();
+    setScopeForSymbol(wibble);
+    fail_unless(wibble->svalue == NULL,
+	"wibble has unexpected value in inner scope");
+    symbolSet("wibble", (Object *) stringNew("inner"));
+
+    symbolSetRoot("wibble", (Object *) stringNew("root"));
+    fail_unless(streq("inner", ((String *) wibble->svalue)->value),
+	"Inner symbol value for wibble is incorrect");
+
+    dropSymbolScope();
+    fail_unless(streq("middle", ((String *) wibble->svalue)->value),
+	"Middle symbol value for wibble is incorrect");
+
+    dropSymbolScope();
+    fail_unless(streq("root", ((String *) wibble->svalue)->value),
+	"Root symbol value for wibble is incorrect");
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 START_TEST(extract_from_list)
 {
     char *sexpstr;
@@ -1109,6 +1143,196 @@ START_TEST(hash_hash2)
 }
 END_TEST
 
+/* Check that keys of different types and lengths are distinguished,
+ * including keys too long for the lookup buffer used by hash.c.
+ */
+START_TEST(hash_keys)
+{
+    Hash *hash = hashNew(TRUE);
+    char *longstr = skalloc(1001);
+    String short_key = {OBJ_STRING, "5"};
+    String long_key = {OBJ_STRING, NULL};
+    Int4 int_key = {OBJ_INT4, 5};
+    Object *prev;
+
+    memset(longstr, 'x', 1000);
+    longstr[1000] = '\0';
+    long_key.value = longstr;
+
+    hashAdd(hash, (Object *) stringNew("5"), (Object *) int4New(1));
+    hashAdd(hash, (Object *) int4New(5), (Object *) int4New(2));
+    hashAdd(hash, (Object *) stringNew(longstr), (Object *) int4New(3));
+
+    fail_unless(hashElems(hash) == 3, "hash_keys: expected 3 entries");
+    fail_unless(((Int4 *) hashGet(hash, (Object *) &short_key))->value == 1,
+		"hash_keys: wrong value for string key");
+    fail_unless(((Int4 *) hashGet(hash, (Object *) &int_key))->value == 2,
+		"hash_keys: wrong value for int4 key");
+    fail_unless(((Int4 *) hashGet(hash, (Object *) &long_key))->value == 3,
+		"hash_keys: wrong value for long key");
+
+    prev = hashAdd(hash, (Object *) stringNew(longstr), 
+		   (Object *) int4New(4));
+    fail_unless(prev && (((Int4 *) prev)->value == 3),
+		"hash_keys: expected previous contents for long key");
+    objectFree(prev, TRUE);
+
+    prev = hashDel(hash, (Object *) &long_key);
+    fail_unless(prev && (((Int4 *) prev)->value == 4),
+		"hash_keys: expected hashDel to return long key contents");
+    objectFree(prev, TRUE);
+    fail_unless(hashElems(hash) == 2, "hash_keys: expected 2 entries");
+
+    skfree(longstr);
+    objectFree((Object *) hash, TRUE);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+START_TEST(small_pools)
+{
+    Cons *cons1 = consNew(NULL, NULL);
+    Cons *cons2 = consNew(NULL, NULL);
+    Cons *cons3;
+    Int4 *int4;
+
+    fail_if(cons1 == cons2, "small_pools: conses share memory");
+    objectFree((Object *) cons1, FALSE);
+    cons3 = consNew(NULL, NULL);
+    fail_unless(cons3 == cons1, "small_pools: freed cons not reused");
+
+    /* Objects of a different size class must not get the freed cons. */
+    objectFree((Object *) cons3, FALSE);
+    int4 = int4New(42);
+    fail_if((void *) int4 == (void *) cons3, 
+	    "small_pools: cons reused for int4");
+    fail_unless(int4->value == 42, "small_pools: int4 value corrupted");
+
+    objectFree((Object *) cons2, FALSE);
+    objectFree((Object *) int4, FALSE);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* Check that nested arenas each own their own allocations, and that
+ * arenas can only be ended in reverse order. */
+START_TEST(arena_nesting)
+{
+    Arena *volatile outer = arenaBegin();
+    Arena *volatile inner = arenaBegin();
+    void *p1;
+    void *p2;
+    void *p3;
+
+    p1 = skallocArena(32);
+    fail_unless(arenaChunksInUse(inner) == 1, 
+		"arena_nesting: chunk not allocated from inner arena");
+    fail_unless(arenaChunksInUse(outer) == 0, 
+		"arena_nesting: chunk allocated from outer arena");
+
+    BEGIN {
+	arenaEnd(outer);
+	fail("arena_nesting: outer arena ended before inner");
+    }
+    EXCEPTION(ex);
+    WHEN(MEMORY_ERROR) {
+	/* This is expected. */
+    }
+    END;
+
+    skfree(p1);
+    arenaEnd(inner);
+    p2 = skallocArena(32);
+    p3 = skallocArena(32);
+    fail_unless(arenaChunksInUse(outer) == 2, 
+		"arena_nesting: chunks not allocated from outer arena");
+    fail_if(p2 == p3, "arena_nesting: arena chunks share memory");
+    skfree(p2);
+    skfree(p3);
+    arenaEnd(outer);
+
+    /* With no arena, allocations come from the small object pools. */
+    p1 = skallocArena(32);
+    skfreeSmall(p1, 32);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* Check that skfree of arena memory releases the chunk without
+ * freeing its memory, including for chunks in later pages of a block
+ * larger than one arena page, and that other memory is still freed as
+ * normal while an arena is active. */
+START_TEST(arena_skfree)
+{
+    Arena *arena = arenaBegin();
+    char *small = skallocArena(16);
+    char *big = skallocArena(5 * 1024 * 1024);
+    char *after = skallocArena(16);
+    char *other = skalloc(16);
+    int in_use = memchunks_in_use();
+
+    fail_unless(arenaChunksInUse(arena) == 3, 
+		"arena_skfree: expected 3 chunks, got %d", 
+		arenaChunksInUse(arena));
+    memset(big, 'x', 5 * 1024 * 1024);
+    skfree(big);
+    fail_unless(arenaChunksInUse(arena) == 2, 
+		"arena_skfree: big chunk not released");
+    fail_unless(big[4 * 1024 * 1024] == 'x', 
+		"arena_skfree: arena memory reclaimed before arenaEnd");
+    skfree(small);
+    skfree(after);
+    skfree(other);
+    fail_unless(memchunks_in_use() == in_use - 4, 
+		"arena_skfree: chunks not released");
+    fail_unless(arenaChunksInUse(arena) == 0, 
+		"arena_skfree: chunks still in use");
+    arenaEnd(arena);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+static int
+arena_unfreed(void *ignore)
+{
+    Arena *arena = arenaBegin();
+    void *chunk;
+    UNUSED(ignore);
+
+    skfree(skallocArena(32));
+    chunk = skallocArena(48);
+    fprintf(stdout, "%p\n", chunk);
+    (void) skallocArena(48);
+    arenaEnd(arena);
+    return 0;
+}
+
+/* Check that chunks that have not been freed when their arena ends are
+ * reported and their memory released. */
+START_TEST(arena_release)
+{
+    char *stderr;
+    char *stdout;
+    char *addr;
+    int   signal = 0;
+
+    captureOutput(arena_unfreed, NULL, &stdout, &stderr, &signal);
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_unless_contains("stderr", stderr, 
+			 "arenaEnd: 2 chunks not freed from arena", NULL);
+    addr = newstr("Arena chunk %.*s not freed", 
+		  (int) strcspn(stdout, "\n"), stdout);
+    fail_unless(strstr(stderr, addr) != NULL, 
+		"arena_release: unfreed chunk not reported");
+    skfree(addr);
+    free(stdout);
+    free(stderr);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 Suite *
 objects_suite(void)
 {
@@ -1139,6 +1363,11 @@ objects_suite(void)
     ADD_TEST(tc_core, hash2);
     ADD_TEST(tc_core, hash_hash);
     ADD_TEST(tc_core, hash_hash2);
+    ADD_TEST(tc_core, hash_keys);
+    ADD_TEST(tc_core, small_pools);
+    ADD_TEST(tc_core, arena_nesting);
+    ADD_TEST(tc_core, arena_skfree);
+    ADD_TEST(tc_core, arena_release);
     ADD_TEST(tc_core, hasherr);
     ADD_TEST(tc_core, nil);
     ADD_TEST(tc_core, emptyhash);
@@ -1167,6 +1396,7 @@ objects_suite(void)
     ADD_TEST(tc_core, symbol_scope1);
     ADD_TEST(tc_core, symbol_scope2);
     ADD_TEST(tc_core, symbol_scope3);
+    ADD_TEST(tc_core, symbol_scope4);
     ADD_TEST(tc_core, extract_from_list);
     ADD_TEST(tc_core, regexp_object);
     ADD_TEST(tc_core, vectorremove);
@@ -1018,6 +1018,336 @@ START_TEST(deps_quiet)
 }
 END_TEST
 
+static int
+do_runsql(void *ignore)
+{
+    char *args[] = {"./skit", "--dbtype", "pgtest",
+		    "-t", "test/templates/runsql.xml", 
+		    "--print", "--xml"};
+    UNUSED(ignore);
+    initTemplatePath(".");
+    registerTestSQL();
+
+    BEGIN {
+	process_args2(7, args);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+    return 0;
+}
+
+/* Check that consecutive runsql elements are executed as a batch, and
+ * that the field values that the db handler provides by reference are
+ * copied into the result document. */
+START_TEST(runsql_batch)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_runsql, NULL, &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_unless(testLastBatchSize() == 2, 
+		"Expected a batch of 2 queries, got %d", 
+		testLastBatchSize());
+    fail_unless_contains("stdout", stdout, 
+			 "<version version=\"8.3.6\"/>", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<role priv=\"keep\" to=\"lose\" admin=\"yes\"/>",
+			 NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<role priv=\"keep2\" to=\"wibble\" admin=\"no\"/>",
+			 NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
+static int
+do_grouped(void *ignore)
+{
+    char *args[] = {"./skit", "--dbtype", "pgtest",
+		    "-t", "test/templates/grouped.xml", 
+		    "--print", "--xml"};
+    UNUSED(ignore);
+    initTemplatePath(".");
+    registerTestSQL();
+
+    BEGIN {
+	process_args2(7, args);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+    return 0;
+}
+
+/* Check that the rows of a grouped cursor can be iterated by key, and
+ * that a key with no rows gives none. */
+START_TEST(runsql_grouped)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_grouped, NULL, &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_unless_contains("stdout", stdout, 
+			 "<grants to=\"wibble\">\n"
+			 "    <grant priv=\"keep\"/>\n"
+			 "    <grant priv=\"keep2\"/>\n"
+			 "  </grants>", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<grants to=\"lose\">\n"
+			 "    <grant priv=\"keep\"/>\n"
+			 "  </grants>", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<grants to=\"nobody\"/>", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<selected to=\"wibble\">\n"
+			 "    <grant priv=\"keep\"/>\n"
+			 "    <grant priv=\"keep2\"/>\n"
+			 "  </selected>", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<selected to=\"nobody\"/>", NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
+static int
+do_jobs(void *jobs)
+{
+    char *args[] = {"./skit", "--dbtype", "pgtest",
+		    "-t", "test/templates/jobs.xml", 
+		    "--jobs", (char *) jobs, "--print", "--xml"};
+    initTemplatePath(".");
+    registerTestSQL();
+
+    BEGIN {
+	process_args2(9, args);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+    return 0;
+}
+
+/* Check that rows processed by worker processes give the same output,
+ * in the same order, as the rows of the roles query in testdata.c
+ * processed by a single process. */
+START_TEST(runsql_jobs)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_jobs, "3", &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_if_contains("stderr", stderr, "EXCEPTION", NULL);
+    fail_if_contains("stderr", stderr, "WARNING", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<grants>\n"
+			 "  <grant priv=\"keep\" to=\"lose\"/>\n"
+			 "  <grant priv=\"keep\" to=\"wibble\"/>\n"
+			 "  <grant priv=\"keep2\" to=\"wibble\"/>\n"
+			 "</grants>", NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
+static int
+do_stream(void *template)
+{
+    char *args[] = {"./skit", "-t", (char *) template, "--stream"};
+    initTemplatePath(".");
+
+    BEGIN {
+	process_args2(4, args);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+    return 0;
+}
+
+/* Check that streamed elements are not opened while the template may
+ * still add attributes to them. */
+START_TEST(stream_late_attrs)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_stream, "test/templates/stream.xml", 
+		  &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_if_contains("stderr", stderr, "EXCEPTION", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<dump type=\"test\">", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<operator name=\"=\" extension=\"ext\">\n"
+			 " *<arg position=\"left\"/>\n"
+			 " *<arg position=\"right\"/>\n"
+			 " *<result/>\n"
+			 " *</operator>", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<operator name=\"&lt;\"/>", NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
+/* Check that the output of skit:xslproc, which must be given its whole
+ * input, is streamed once it is added to a streamed element. */
+START_TEST(stream_xslproc)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_stream, "test/templates/stream_xslproc.xml", 
+		  &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_if_contains("stderr", stderr, "EXCEPTION", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<dump>\n"
+			 "  <before/>\n"
+			 "  <objects>\n"
+			 "    <object name=\"a\"/>\n"
+			 "    <object name=\"b\" owner=\"x\"/>\n"
+			 "  </objects>\n"
+			 "  <after/>\n"
+			 "</dump>", NULL);
+    fail_if_contains("stdout", stdout, "dbincluster", NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
+static int
+do_stream_jobs(void *ignore)
+{
+    char *args[] = {"./skit", "--dbtype", "pgtest",
+		    "-t", "test/templates/jobs.xml", 
+		    "--jobs", "3", "--stream"};
+    UNUSED(ignore);
+    initTemplatePath(".");
+    registerTestSQL();
+
+    BEGIN {
+	process_args2(8, args);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+	fprintf(stderr, "%s\n", ex->backtrace);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+    return 0;
+}
+
+/* Check that rows produced by worker processes are streamed, in order,
+ * when added to a streamed parent. */
+START_TEST(stream_jobs)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_stream_jobs, NULL, &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_if_contains("stderr", stderr, "EXCEPTION", NULL);
+    fail_if_contains("stderr", stderr, "WARNING", NULL);
+    fail_unless_contains("stdout", stdout, 
+			 "<grants>\n"
+			 "  <grant priv=\"keep\" to=\"lose\"/>\n"
+			 "  <grant priv=\"keep\" to=\"wibble\"/>\n"
+			 "  <grant priv=\"keep2\" to=\"wibble\"/>\n"
+			 "</grants>", NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
+static int
+do_stream_not_last(void *ignore)
+{
+    char *args[] = {"./skit", "-t", "test/templates/stream.xml", 
+		    "--stream", "--list"};
+    UNUSED(ignore);
+    initTemplatePath(".");
+
+    BEGIN {
+	process_args2(5, args);
+    }
+    EXCEPTION(ex);
+    WHEN_OTHERS {
+	fprintf(stderr, "EXCEPTION %d, %s\n", ex->signal, ex->text);
+    }
+    END;
+
+    FREEMEMWITHCHECK;
+    return 0;
+}
+
+/* A streamed result is not left for following actions, so --stream
+ * must be used only for the last action. */
+START_TEST(stream_not_last)
+{
+    char *stderr;
+    char *stdout;
+    int   signal = 0;
+    captureOutput(do_stream_not_last, NULL, &stdout, &stderr, &signal);
+
+    if (signal != 0) {
+	fail("Unexpected signal: %d\n", signal);
+    }
+    fail_unless_contains("stderr", stderr, 
+			 "EXCEPTION.*--stream may only be used for the "
+			 "last action", NULL);
+    fail_if_contains("stdout", stdout, "<dump", NULL);
+    free(stdout);
+    free(stderr);
+}
+END_TEST
+
 
 
 Suite *
@@ -1044,6 +1374,13 @@ params_suite(void)
     // Various parameters that must work
     ADD_TEST(tc_core, list);
     ADD_TEST(tc_core, deps_quiet);
+    ADD_TEST(tc_core, runsql_batch);
+    ADD_TEST(tc_core, runsql_grouped);
+    ADD_TEST(tc_core, runsql_jobs);
+    ADD_TEST(tc_core, stream_late_attrs);
+    ADD_TEST(tc_core, stream_xslproc);
+    ADD_TEST(tc_core, stream_jobs);
+    ADD_TEST(tc_core, stream_not_last);
     ADD_TEST(tc_core, dbtype);
     ADD_TEST(tc_core, dbtype_unknown);
 
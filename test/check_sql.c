@@ -0,0 +1,118 @@
+/**
+ * @file   check_sql.c
+ * \code
+ *     Copyright (c) 2009 - 2015 Marc Munro
+ *     Fileset:	skit - a database schema management toolset
+ *     Author:  Marc Munro
+ *     License: GPL V3
+ *
+ * \endcode
+ * @brief
+ * Unit tests for sql query handling
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "../src/skit.h"
+#include "../src/exceptions.h"
+#include "suites.h"
+
+#define PARAMS "('tab' 'val' '(1,2)' 'v4' 'v5' 'v6' 'v7' 'v8' 'v9' 'v10')"
+
+/* A query using placeholders in each of the ways that templates do.
+ * :1 is a table name and :3 a parenthesised list, so can only be
+ * substituted textually.  The rest are values. */
+#define QUERY							\
+    "select * from :1 where name = :2 and x in :3\n"		\
+    "and y = ':4' -- :5 is not used here\n"			\
+    "and z = :5::int and w = :10 and c = 'x:2' and n >= :2"
+
+START_TEST(apply_params)
+{
+    Object *params = objectFromStr(PARAMS);
+    char *result;
+
+    result = applyParams(QUERY, params);
+    fail_unless(streq(result,
+		      "select * from tab where name = val and x in (1,2)\n"
+		      "and y = 'v4' -- :5 is not used here\n"
+		      "and z = v5::int and w = v10 and c = 'xval' "
+		      "and n >= val"),
+		"Incorrect substitution: %s", result);
+    skfree(result);
+    objectFree(params, TRUE);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+START_TEST(bind_params)
+{
+    Object *params = objectFromStr(PARAMS);
+    char **bound_values;
+    int nbound;
+    char *result;
+
+    result = bindParams(QUERY, params, &nbound, &bound_values);
+    fail_unless(streq(result,
+		      "select * from tab where name = $1 and x in (1,2)\n"
+		      "and y = $2 -- :5 is not used here\n"
+		      "and z = $3::int and w = $4 and c = 'xval' "
+		      "and n >= $1"),
+		"Incorrect substitution: %s", result);
+    fail_unless(nbound == 4, "Expected 4 bound values, got %d", nbound);
+    fail_unless(streq(bound_values[0], "val"),
+		"Incorrect $1: %s", bound_values[0]);
+    fail_unless(streq(bound_values[1], "v4"),
+		"Incorrect $2: %s", bound_values[1]);
+    fail_unless(streq(bound_values[2], "v5"),
+		"Incorrect $3: %s", bound_values[2]);
+    fail_unless(streq(bound_values[3], "v10"),
+		"Incorrect $4: %s", bound_values[3]);
+    skfree(bound_values);
+    skfree(result);
+    objectFree(params, TRUE);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+/* Placeholders outside of the range of our parameters, and anything
+ * that only looks like one, are left alone. */
+START_TEST(bind_textual)
+{
+    Object *params = objectFromStr("'pg_class'");
+    char **bound_values;
+    int nbound;
+    char *result;
+
+    result = bindParams("select oid::regclass from :1 where x in :2",
+			params, &nbound, &bound_values);
+    fail_unless(streq(result,
+		      "select oid::regclass from pg_class where x in :2"),
+		"Incorrect substitution: %s", result);
+    fail_unless(nbound == 0, "Expected no bound values, got %d", nbound);
+    fail_unless(bound_values == NULL, "Unexpected bound values");
+    skfree(result);
+    objectFree(params, TRUE);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+
+Suite *
+sql_suite(void)
+{
+    Suite *s = suite_create("Sql");
+
+    /* Core test case */
+    TCase *tc_core = tcase_create("Sql");
+    ADD_TEST(tc_core, apply_params);
+    ADD_TEST(tc_core, bind_params);
+    ADD_TEST(tc_core, bind_textual);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
@@ -814,6 +814,210 @@ START_TEST(fallback)
 }
 END_TEST
 
+/* The recursive version of tsort_node that was replaced by the
+ * iterative version in tsort.c.  It is kept as the reference for the
+ * order in which simple_tsort must return nodes, and for its
+ * descriptions of cyclic dependencies.
+ */
+static void
+recursive_tsort_node(DagNode *node, Vector *results)
+{
+    Vector *deps;
+    DagNode *cycle_node;
+    boolean cyclic_exception = FALSE;
+    char *errmsg;
+    char *tmpmsg;
+    int i;
+
+    switch (node->status) {
+    case VISITING:
+	RAISE(TSORT_CYCLIC_DEPENDENCY, 
+	      newstr("(%s) %s", nameForBuildType(node->build_type),
+		     node->fqn->value), node);
+    case UNVISITED: 
+    case RESOLVED: 
+	BEGIN {
+	    node->status = VISITING;
+	    if ((node->build_type != DEACTIVATED_NODE) && 
+		(deps = node->deps)) {
+		EACH(deps, i) {
+		    node->cur_dep = i;
+		    recursive_tsort_node((DagNode *) ELEM(deps, i), results);
+		}
+	    }
+	    vectorPush(results, (Object *) node);
+	}
+	EXCEPTION(ex);
+	WHEN(TSORT_CYCLIC_DEPENDENCY) {
+	    cyclic_exception = TRUE;
+	    cycle_node = (DagNode *) ex->param;
+	    errmsg = newstr("%s", ex->text);
+	}
+	END;
+	if (cyclic_exception) {
+	    if (node == cycle_node) {
+		if (breakCycle(node)) {
+		    node->status = UNVISITED;
+		    skfree(errmsg);
+		    recursive_tsort_node(node, results);
+		    return;
+		}
+		tmpmsg = newstr("Cyclic dependency detected: (%s) %s->%s", 
+				nameForBuildType(node->build_type),
+				node->fqn->value, errmsg);
+		cycle_node = NULL;
+	    }
+	    else  {
+		tmpmsg = newstr("(%s) %s->%s", 
+				nameForBuildType(node->build_type),
+				node->fqn->value, errmsg);
+	    }
+	    skfree(errmsg);
+	    node->status = UNVISITED;
+	    RAISE(TSORT_CYCLIC_DEPENDENCY, tmpmsg, cycle_node);
+	}
+	node->status = VISITED;
+	break;
+    case VISITED: 
+	break;
+    default:
+	RAISE(TSORT_ERROR,
+	      newstr("Unexpected status for dagnode %s: %d",
+		     node->fqn->value, node->status));
+    }
+}
+
+/* Sort the dag from the document at path, using either simple_tsort or
+ * the recursive reference version.  Returns a list of the build types
+ * and fqns of the sorted nodes, or the text of the exception if the
+ * sort fails.
+ */
+static Object *
+sortedNames(char *path, boolean recursive)
+{
+    Document *volatile doc = getDoc(path);
+    Vector *volatile nodes = NULL;
+    Vector *volatile results = NULL;
+    Object *volatile names = NULL;
+    DagNode *node;
+    char *tmp;
+    int i;
+
+    BEGIN {
+	nodes = dagFromDoc(doc);
+	if (recursive) {
+	    results = vectorNew(nodes->elems + 10);
+	    EACH(nodes, i) {
+		recursive_tsort_node((DagNode *) ELEM(nodes, i), results);
+	    }
+	}
+	else {
+	    results = simple_tsort(nodes);
+	}
+	names = (Object *) vectorNew(results->elems);
+	EACH(results, i) {
+	    node = (DagNode *) ELEM(results, i);
+	    tmp = newstr("%s.%s", nameForBuildType(node->build_type),
+			 node->fqn->value);
+	    vectorPush((Vector *) names, (Object *) stringNewByRef(tmp));
+	}
+    }
+    EXCEPTION(ex);
+    WHEN(TSORT_CYCLIC_DEPENDENCY) {
+	objectFree(names, TRUE);
+	names = (Object *) stringNew(ex->text);
+    }
+    END;
+    if (results) {
+	objectFree((Object *) results, FALSE);
+    }
+    objectFree((Object *) nodes, TRUE);
+    objectFree((Object *) doc, TRUE);
+    return names;
+}
+
+static void
+check_same_order(char *path)
+{
+    Object *expected = sortedNames(path, TRUE);
+    Object *results = sortedNames(path, FALSE);
+    char *expected_str = objectSexp(expected);
+    char *results_str = objectSexp(results);
+
+    if (!streq(expected_str, results_str)) {
+	fprintf(stderr, "EXPECTED: %s\n\nGOT: %s\n", 
+		expected_str, results_str);
+	fail("tsort order differs from reference for %s", path);
+    }
+    skfree(expected_str);
+    skfree(results_str);
+    objectFree(expected, TRUE);
+    objectFree(results, TRUE);
+}
+
+/* Check that simple_tsort gives exactly the same order as the
+ * recursive version that it replaced, for each of the test dags,
+ * including those with cycles that must be broken and one with a cycle
+ * that cannot be.
+ */
+START_TEST(same_order)
+{
+    initTemplatePath(".");
+    setq_build();
+    setq_drop();
+
+    check_same_order("test/data/gensource1.xml");
+    check_same_order("test/data/gensource2.xml");
+    check_same_order("test/data/gensource3.xml");
+    check_same_order("test/data/gensource_diff.xml");
+    check_same_order("test/data/gensource_depset.xml");
+    check_same_order("test/data/gensource_depset_rebuild.xml");
+    check_same_order("test/data/fallback.xml");
+
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
+#define CHAIN_LENGTH 100000
+
+/* Check that a chain of dependencies far deeper than the C stack would
+ * allow for a recursive sort is sorted correctly. */
+START_TEST(deep_chain)
+{
+    xmlNode *dbobject = xmlNewNode(NULL, (xmlChar *) "dbobject");
+    Vector *nodes = vectorNew(CHAIN_LENGTH);
+    Vector *results;
+    DagNode *node;
+    int i;
+
+    xmlNewProp(dbobject, (xmlChar *) "fqn", (xmlChar *) "link");
+    for (i = 0; i < CHAIN_LENGTH; i++) {
+	node = dagNodeNew(dbobject, BUILD_NODE);
+	if (i) {
+	    /* Each node depends on the one created after it. */
+	    ((DagNode *) ELEM(nodes, i - 1))->deps = vectorNew(1);
+	    vectorPush(((DagNode *) ELEM(nodes, i - 1))->deps, 
+		       (Object *) node);
+	}
+	vectorPush(nodes, (Object *) node);
+    }
+
+    results = simple_tsort(nodes);
+    fail_unless(results->elems == CHAIN_LENGTH, 
+		"deep_chain: expected %d nodes, got %d", 
+		CHAIN_LENGTH, results->elems);
+    EACH(results, i) {
+	if (ELEM(results, i) != ELEM(nodes, CHAIN_LENGTH - 1 - i)) {
+	    fail("deep_chain: node %d out of order", i);
+	}
+    }
+    objectFree((Object *) results, FALSE);
+    objectFree((Object *) nodes, TRUE);
+    xmlFreeNode(dbobject);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 
 #ifdef WIBBLE
 static Document *
@@ -937,6 +1141,8 @@ tsort_suite(void)
     ADD_TEST(tc_core, depset2);
     ADD_TEST(tc_core, depset_rebuild);
     ADD_TEST(tc_core, fallback);
+    ADD_TEST(tc_core, same_order);
+    ADD_TEST(tc_core, deep_chain);
 
     // For debugging regression tests
     //ADD_TEST(tc_core, rt3);
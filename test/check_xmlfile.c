@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <check.h>
 #include "../src/skit.h"
 #include "../src/exceptions.h"
@@ -148,6 +149,50 @@ START_TEST(adddeps)
 }
 END_TEST
 
+/* Test that a document survives a round trip through a binary dump.
+ *
+ */
+START_TEST(bindump)
+{
+    String *filename = stringNew("test/testfiles/x.xml");
+    String *binpath;
+    char tmpname[] = "/tmp/skit_bindump_XXXXXX";
+    Document *doc;
+    Document *bindoc;
+    char *str;
+    char *binstr;
+    FILE *fp;
+
+    initTemplatePath("test/");
+
+    doc = docFromFile(filename);
+    fail_unless(doc != NULL, "Failed to load %s", filename->value);
+
+    fp = fdopen(mkstemp(tmpname), "w");
+    binaryDumpWrite(fp, doc);
+    fclose(fp);
+
+    binpath = stringNew(tmpname);
+    fail_unless(isBinaryDump(binpath), "Binary dump not recognised");
+    bindoc = docFromFile(binpath);
+    (void) unlink(tmpname);
+
+    str = documentStr(doc);
+    binstr = documentStr(bindoc);
+    fail_unless(streq(str, binstr), 
+		"Binary dump does not match original.  Expected:\n%s\n"
+		"Got:\n%s\n", str, binstr);
+
+    skfree(str);
+    skfree(binstr);
+    objectFree((Object *) bindoc, TRUE);
+    objectFree((Object *) doc, TRUE);
+    objectFree((Object *) binpath, TRUE);
+    objectFree((Object *) filename, TRUE);
+    FREEMEMWITHCHECK;
+}
+END_TEST
+
 
 Suite *
 xmlfile_suite(void)
@@ -159,6 +204,7 @@ xmlfile_suite(void)
     ADD_TEST(tc_core, optiontest);
     ADD_TEST(tc_core, docfromfile);  // NEXT THING TO DO!
     ADD_TEST(tc_core, adddeps);
+    ADD_TEST(tc_core, bindump);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -35,6 +35,7 @@ extern Suite *xmlfile_suite(void);
 extern Suite *relaxng_suite(void);
 extern Suite *tsort_suite(void);
 extern Suite *deps_suite(void);
+extern Suite *sql_suite(void);
 
 // Utility functions
 extern Object *objectFromStr(char *instr);
@@ -61,6 +62,7 @@ extern void end_redirects(void);
 
 // testdata.c
 void registerTestSQL(void);
+int testLastBatchSize(void);
 
 
 // check_params.c
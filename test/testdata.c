@@ -240,6 +240,11 @@ testExecQry(Connection *connection,
 	curs->tuple.dynamic = FALSE;
 	curs->tuple.rownum = 0;
 	curs->querystr = stringNew(qry->value);
+	curs->index = NULL;
+	curs->groups = NULL;
+	curs->base = NULL;
+	curs->rowmap = NULL;
+	curs->fieldvals = NULL;
     }
     else {
 	compare(last_key, key);
@@ -253,6 +258,49 @@ testExecQry(Connection *connection,
 
 }
 
+/* The number of queries in the most recent batch, so that tests can
+ * check that skit:runsql elements have been batched. */
+static int last_batch_size = 0;
+
+static Cons *
+testExecBatch(Connection *connection, Cons *queries)
+{
+    Cons *volatile results = NULL;
+    Cons *qry;
+    Cursor *cursor;
+
+    last_batch_size = 0;
+    BEGIN {
+	for (qry = queries; qry; qry = (Cons *) qry->cdr) {
+	    cursor = testExecQry(connection, (String *) qry->car, NULL);
+	    results = consAppend(results, (Object *) cursor);
+	    last_batch_size++;
+	}
+    }
+    EXCEPTION(ex) {
+	objectFree((Object *) results, TRUE);
+    }
+    END;
+    return results;
+}
+
+int
+testLastBatchSize()
+{
+    return last_batch_size;
+}
+
+/* As pgRow() in pgsql.c, return the index into the canned results of
+ * rownum, which for a group cursor is a row within its group. */
+static int
+testRow(Cursor *cursor, int rownum)
+{
+    if (cursor->rowmap) {
+	return cursor->rowmap[rownum - 1];
+    }
+    return rownum - 1;
+}
+
 static Object *
 testFieldByIdx(Tuple *tuple, int col)
 {
@@ -260,12 +308,14 @@ testFieldByIdx(Tuple *tuple, int col)
     Cons *results = (Cons *) curs->cursor;
     Vector *rows = (Vector *) ((Cons *) results->cdr)->car;
     Vector *result_row;
-    int row = tuple->rownum - 1;
+    int row = testRow(curs, tuple->rownum);
     String *result;
 
+    /* As with the postgres handler, field values belong to the cursor
+     * (here, to the canned results) so we return a reference. */
     result_row = (Vector *) rows->contents->vector[row];
     if (result = (String *) result_row->contents->vector[col]) {
-	return (Object *) stringNew(result->value);
+	return (Object *) objRefNew((Object *) result);
     }
     return NULL;
 }
@@ -314,17 +364,19 @@ testTupleStr(Tuple *tuple)
     Cons *results = (Cons *) cursor->cursor;
     Vector *fields = (Vector *) results->car;
     String *name;
-    String *value;
+    Object *value;
+    String *str;
     int col;
     char *result = newstr("");
     char *tmp;
     for (col = 0; col < cursor->cols; col++) {
 	name = (String *) fields->contents->vector[col];
-	value = (String *) testFieldByIdx(tuple, col);
+	value = testFieldByIdx(tuple, col);
 	tmp = result;
 	if (value) {
-	    result = newstr("%s ('%s' . '%s')", tmp, name->value, value->value);
-	    objectFree((Object *) value, TRUE);
+	    str = (String *) dereference(value);
+	    result = newstr("%s ('%s' . '%s')", tmp, name->value, str->value);
+	    objectFree(value, TRUE);
 	}
 	else {
 	    result = newstr("%s ('%s')", tmp, name->value);
@@ -337,9 +389,94 @@ testTupleStr(Tuple *tuple)
     return result;
 }
 
+static Cursor *
+testGroupCursorNew(Cursor *cursor)
+{
+    Cursor *group = (Cursor *) skalloc(sizeof(Cursor));
+
+    *group = *cursor;
+    group->rows = 0;
+    group->fields = NULL;
+    group->tuple.cursor = group;
+    group->tuple.rownum = 0;
+    group->index = NULL;
+    group->groups = NULL;
+    group->base = cursor;
+    group->rowmap = NULL;
+    group->fieldvals = NULL;
+    return group;
+}
+
+/* Group the rows of cursor by fieldname, as pgsqlGroupCursor() does,
+ * so that grouped cursors may be tested without a database.
+ */
+static void
+testGroupCursor(Cursor *cursor, String *fieldname)
+{
+    Cons *results = (Cons *) cursor->cursor;
+    Vector *fields = (Vector *) results->car;
+    Vector *rows = (Vector *) ((Cons *) results->cdr)->car;
+    Vector *row_vec;
+    String *value;
+    Cursor *group;
+    int col;
+    int row;
+
+    objectFree((Object *) cursor->groups, TRUE);
+    cursor->groups = NULL;
+    for (col = fields->elems - 1; col >= 0; col--) {
+	if (stringCmp(fieldname, (String *) fields->contents->vector[col]) == 0) {
+	    break;
+	}
+    }
+    if (col < 0) {
+	return;
+    }
+    cursor->groups = hashNew(TRUE);
+
+    /* Count the rows for each group, and then record them. */
+    for (row = 0; row < cursor->rows; row++) {
+	row_vec = (Vector *) rows->contents->vector[row];
+	if (value = (String *) row_vec->contents->vector[col]) {
+	    if (!(group = (Cursor *) hashGet(cursor->groups, 
+					     (Object *) value))) {
+		group = testGroupCursorNew(cursor);
+		(void) hashAdd(cursor->groups, objectCopy((Object *) value),
+			       (Object *) group);
+	    }
+	    group->rows++;
+	}
+    }
+    for (row = 0; row < cursor->rows; row++) {
+	row_vec = (Vector *) rows->contents->vector[row];
+	if (value = (String *) row_vec->contents->vector[col]) {
+	    group = (Cursor *) hashGet(cursor->groups, (Object *) value);
+	    if (!group->rowmap) {
+		group->rowmap = (int *) skalloc(sizeof(int) * group->rows);
+	    }
+	    group->rowmap[group->tuple.rownum++] = row;
+	}
+    }
+    for (row = 0; row < cursor->rows; row++) {
+	row_vec = (Vector *) rows->contents->vector[row];
+	if (value = (String *) row_vec->contents->vector[col]) {
+	    group = (Cursor *) hashGet(cursor->groups, (Object *) value);
+	    group->tuple.rownum = 0;
+	}
+    }
+}
+
 static void
 testFreeCursor(Cursor *cursor)
 {
+    if (cursor->base) {
+	/* A group cursor: the query string belongs to the grouped
+	 * cursor. */
+	skfree((void *) cursor->rowmap);
+	skfree((void *) cursor);
+	return;
+    }
+    objectFree((Object *) cursor->groups, TRUE);
     objectFree((Object *) cursor->querystr, TRUE);
     skfree((void *) cursor);
 }
@@ -353,6 +490,19 @@ testCleanup(Connection *conn)
     skfree(conn);
 }
 
+/* The test data never changes, so every connection trivially sees
+ * the same data: there is nothing to export or import. */
+static String *
+testExportSnapshot(Connection *conn)
+{
+    return stringNew("test");
+}
+
+static void
+testImportSnapshot(Connection *conn, String *snapshot)
+{
+}
+
 void
 registerTestSQL()
 {
@@ -360,16 +510,21 @@ registerTestSQL()
 	OBJ_MISC,
 	&testConnect,
 	&testExecQry,
+	&testExecBatch,
 	&testNextRow,
 	&testFieldByIdx,
 	&testFieldByName,
 	&testTupleStr,
 	&testCursorStr,
 	NULL,
+	&testGroupCursor,
 	NULL,
 	NULL,
 	&testFreeCursor,
-	&testCleanup
+	&testCleanup,
+	&testExportSnapshot,
+	&testImportSnapshot,
+	NULL
     };
     
     ObjReference *obj = objRefNew((Object *) &funcs);